@@ -0,0 +1,34 @@
+QMAKE_CXXFLAGS += -std=c++2a
+QMAKE_CXXFLAGS += -Wno-deprecated-enum-enum-conversion
+
+INCLUDEPATH += ../lib
+INCLUDEPATH += ../pan2kpack
+LIBS += -lz -llz4
+DEFINES += BUILD_WITH_LZ4
+SOURCES += \
+    ../lib/kbase.cpp \
+    ../lib/kcodec.cpp \
+    ../lib/klocker.cpp \
+    ../lib/kpack.cpp \
+    ../lib/kprojection.cpp \
+    ../lib/kclass.cpp \
+    ../lib/kobject.cpp \
+    ../lib/krtree.cpp \
+    ../lib/ktilestore.cpp \
+    ../lib/kclassmanager.cpp \
+    ../pan2kpack/kpanclassmanager.cpp \
+    main.cpp
+
+HEADERS += \
+ ../lib/kbase.h \
+    ../lib/kcodec.h \
+    ../lib/klocker.h \
+    ../lib/kpack.h \
+    ../lib/kprojection.h \
+    ../lib/kserialize.h \
+    ../lib/kclass.h \
+    ../lib/krtree.h \
+    ../lib/ktilestore.h \
+    ../lib/kclassmanager.h \
+    ../pan2kpack/kpanclass.h \
+    ../pan2kpack/kpanclassmanager.h
@@ -0,0 +1,484 @@
+#include <QCoreApplication>
+#include <QDir>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QMetaEnum>
+#include "kpack.h"
+#include "ktilestore.h"
+#include "kprojection.h"
+#include "kpanclassmanager.h"
+#include <QRandomGenerator>
+
+QVector<QByteArray> getRawBlocks(QString path)
+{
+  KPack pack;
+  pack.loadMain(path, true, 0);
+  pack.main.status = KTile::Loaded;
+  for (int i = 0; i < pack.tiles.count(); i++)
+    pack.loadTile(path, i);
+
+  QVector<QByteArray> blocks;
+  QByteArray          ba;
+  for (auto& obj: pack.main)
+    obj.save(pack.classes, ba);
+  blocks.append(ba);
+  for (auto& tile: pack.tiles)
+  {
+    if (tile.isEmpty())
+      continue;
+    ba.clear();
+    for (auto& obj: tile)
+      obj.save(pack.classes, ba);
+    blocks.append(ba);
+  }
+  return blocks;
+}
+
+int benchCodec(QString dir_path, int repeat_count)
+{
+  QDir dir(dir_path);
+  dir.setFilter(QDir::Files | QDir::NoSymLinks |
+                QDir::NoDotAndDotDot);
+
+  QVector<QByteArray> blocks;
+  qint64              file_size = 0;
+  for (auto& fi: dir.entryInfoList())
+  {
+    if (fi.suffix() != "kpack")
+      continue;
+    qDebug() << "reading" << fi.fileName();
+    file_size += fi.size();
+    blocks.append(getRawBlocks(fi.absoluteFilePath()));
+  }
+  if (blocks.isEmpty())
+  {
+    qDebug() << "ERROR: no packs found in" << dir_path;
+    return -1;
+  }
+
+  qint64 raw_size = 0;
+  for (auto& block: blocks)
+    raw_size += block.count();
+  qDebug() << "packs size on disk" << file_size << "raw blocks size"
+           << raw_size << "block count" << blocks.count();
+
+  auto me = QMetaEnum::fromType<KCodec::Type>();
+  for (int i = 0; i < me.keyCount(); i++)
+  {
+    auto codec = static_cast<KCodec::Type>(me.value(i));
+
+    QElapsedTimer t;
+    t.start();
+    QVector<QByteArray> compressed_blocks;
+    qint64              compressed_size = 0;
+    for (auto& block: blocks)
+    {
+      compressed_blocks.append(KCodec::compress(codec, block));
+      compressed_size += compressed_blocks.last().count();
+    }
+    double encode_s = t.nsecsElapsed() * 1e-9;
+
+    QByteArray dst;
+    bool       ok = true;
+    t.restart();
+    for (int r = 0; r < repeat_count; r++)
+      for (int j = -1; auto& block: compressed_blocks)
+      {
+        j++;
+        ok &= KCodec::uncompress(
+            codec, (const uchar*)block.constData(), block.count(),
+            blocks[j].count(), dst);
+      }
+    double decode_s = t.nsecsElapsed() * 1e-9;
+
+    double raw_mb = raw_size / 1e6;
+    qDebug().noquote()
+        << KCodec::toString(codec) << "size" << compressed_size
+        << QString("ratio %1")
+               .arg(1.0 * raw_size / compressed_size, 0, 'f', 2)
+        << QString("encode %1 MB/s")
+               .arg(raw_mb / encode_s, 0, 'f', 1)
+        << QString("decode %1 MB/s")
+               .arg(raw_mb * repeat_count / decode_s, 0, 'f', 1)
+        << (ok ? "" : "DECODE ERROR");
+  }
+  return 0;
+}
+
+qint64 getObjectMemorySize(const KObject& obj)
+{
+  constexpr int alloc_overhead = 16 + sizeof(QArrayData);
+  constexpr int map_node_size  = 16 + 3 * sizeof(void*) +
+                                sizeof(QString) + sizeof(QByteArray);
+
+  qint64 size = sizeof(KObject);
+  if (!obj.name.isEmpty())
+    size += alloc_overhead + obj.name.capacity() * sizeof(QChar);
+  size += alloc_overhead +
+          obj.polygons.capacity() * sizeof(KGeoPolygon);
+  for (auto& polygon: obj.polygons)
+    size += alloc_overhead + polygon.capacity() * sizeof(KGeoCoor);
+  if (!obj.lods.isEmpty())
+    size += alloc_overhead + obj.lods.capacity() * sizeof(KObjectLod);
+  for (auto& lod: obj.lods)
+  {
+    size += alloc_overhead +
+            lod.polygons.capacity() * sizeof(KGeoPolygon);
+    for (auto& polygon: lod.polygons)
+      size += alloc_overhead + polygon.capacity() * sizeof(KGeoCoor);
+  }
+  for (auto it = obj.attributes.begin(); it != obj.attributes.end();
+       it++)
+    size += map_node_size + 2 * alloc_overhead +
+            it.key().capacity() * sizeof(QChar) +
+            it.value().capacity();
+  return size;
+}
+
+int benchStore(QString dir_path)
+{
+  QDir dir(dir_path);
+  dir.setFilter(QDir::Files | QDir::NoSymLinks |
+                QDir::NoDotAndDotDot);
+
+  qint64        object_memory_size    = 0;
+  qint64        store_memory_size     = 0;
+  qint64        projected_memory_size = 0;
+  qint64        object_walk_ns        = 0;
+  qint64        store_walk_ns         = 0;
+  qint64        projected_walk_ns     = 0;
+  double        object_sum            = 0;
+  double        store_sum             = 0;
+  double        projected_sum         = 0;
+  int           tile_count            = 0;
+  QElapsedTimer t;
+  for (auto& fi: dir.entryInfoList())
+  {
+    if (fi.suffix() != "kpack")
+      continue;
+    qDebug() << "reading" << fi.fileName();
+    KPack pack;
+    auto  path = fi.absoluteFilePath();
+    pack.loadMain(path, true, 0);
+    pack.main.status = KTile::Loaded;
+    for (int i = 0; i < pack.tiles.count(); i++)
+      pack.loadTile(path, i);
+
+    auto tiles = pack.tiles;
+    tiles.append(pack.main);
+    for (auto& tile: tiles)
+    {
+      if (tile.isEmpty())
+        continue;
+      tile_count++;
+      KTileStore store;
+      for (auto& obj: tile)
+      {
+        object_memory_size += getObjectMemorySize(obj);
+        store.append(obj);
+      }
+      store.squeeze();
+      store_memory_size += store.getMemorySize();
+
+      t.start();
+      for (auto& obj: tile)
+      {
+        for (auto& polygon: obj.polygons)
+          for (auto& coor: polygon)
+            object_sum += coor.latitude();
+        for (auto& lod: obj.lods)
+          for (auto& polygon: lod.polygons)
+            for (auto& coor: polygon)
+              object_sum += coor.latitude();
+      }
+      object_walk_ns += t.nsecsElapsed();
+
+      t.start();
+      for (auto& coor: store.coors)
+        store_sum += coor.latitude();
+      store_walk_ns += t.nsecsElapsed();
+
+      store.project();
+      store.squeeze();
+      projected_memory_size += store.getMemorySize();
+
+      t.start();
+      for (int i = 0; i < store.polygon_origins_m.count(); i++)
+      {
+        int     count = 0;
+        QPointF origin_m;
+        auto    polygon = store.getPolygonM(i, count, origin_m);
+        for (int j = 0; j < count; j++)
+          projected_sum += origin_m.y() + polygon[j].y;
+      }
+      projected_walk_ns += t.nsecsElapsed();
+    }
+  }
+  if (tile_count == 0)
+  {
+    qDebug() << "ERROR: no packs found in" << dir_path;
+    return -1;
+  }
+
+  qDebug() << "tile count" << tile_count;
+  qDebug() << "KObject tiles memory" << object_memory_size
+           << "walk ms" << object_walk_ns * 1e-6;
+  qDebug() << "KTileStore memory" << store_memory_size << "walk ms"
+           << store_walk_ns * 1e-6;
+  qDebug() << "projected KTileStore memory" << projected_memory_size
+           << "walk ms" << projected_walk_ns * 1e-6 << "sum"
+           << projected_sum;
+  qDebug() << "memory ratio"
+           << 1.0 * object_memory_size / store_memory_size
+           << "projected" << 1.0 * object_memory_size /
+                                 projected_memory_size
+           << "checksum" << (object_sum == store_sum);
+  return 0;
+}
+
+int benchProj(int point_count)
+{
+  QVector<KGeoCoor> coors;
+  auto              rg = QRandomGenerator(1);
+  for (int i = 0; i < point_count; i++)
+    coors.append(KGeoCoor::fromDegs(rg.bounded(170.0) - 85,
+                                    rg.bounded(360.0) - 180));
+
+  QVector<QPointF> scalar_m(point_count);
+  QVector<QPointF> batch_m(point_count);
+  QElapsedTimer    t;
+  t.start();
+  for (int i = 0; i < point_count; i++)
+    scalar_m[i] = coors[i].toMeters();
+  double scalar_s = t.nsecsElapsed() * 1e-9;
+
+  t.restart();
+  kmath::deg2meters(coors.constData(), point_count, batch_m.data());
+  double batch_s = t.nsecsElapsed() * 1e-9;
+
+  double max_error_m = 0;
+  for (int i = 0; i < point_count; i++)
+  {
+    auto d      = scalar_m[i] - batch_m[i];
+    max_error_m = std::max(
+        max_error_m, std::max(std::abs(d.x()), std::abs(d.y())));
+  }
+
+  qDebug() << "kernel" << kmath::getProjectionKernelName();
+  qDebug() << "toMeters() Mpoints/s" << point_count / scalar_s * 1e-6;
+  qDebug() << "deg2meters() Mpoints/s"
+           << point_count / batch_s * 1e-6;
+  qDebug() << "max error m" << max_error_m;
+  return 0;
+}
+
+int benchRTree(QString dir_path, double mip)
+{
+  QDir dir(dir_path);
+  dir.setFilter(QDir::Files | QDir::NoSymLinks |
+                QDir::NoDotAndDotDot);
+
+  QVector<KTileStore> stores;
+  for (auto& fi: dir.entryInfoList())
+  {
+    if (fi.suffix() != "kpack")
+      continue;
+    qDebug() << "reading" << fi.fileName();
+    KPack pack;
+    auto  path = fi.absoluteFilePath();
+    pack.loadMain(path, true, 0);
+    pack.main.status = KTile::Loaded;
+    for (int i = 0; i < pack.tiles.count(); i++)
+      pack.loadTile(path, i);
+
+    auto tiles = pack.tiles;
+    tiles.append(pack.main);
+    for (auto& tile: tiles)
+    {
+      if (tile.isEmpty())
+        continue;
+      KTileStore store;
+      for (auto& obj: tile)
+        store.append(obj);
+      store.project();
+      store.buildIndex();
+      store.squeeze();
+      stores.append(store);
+    }
+  }
+  if (stores.isEmpty())
+  {
+    qDebug() << "ERROR: no packs found in" << dir_path;
+    return -1;
+  }
+
+  const int    frame_count = 1000;
+  const QSizeF frame_size  = {2 * 1920 * mip, 2 * 1080 * mip};
+
+  auto            rg = QRandomGenerator(1);
+  QVector<QRectF> frames;
+  for (int i = 0; i < frame_count; i++)
+  {
+    auto& store = stores[rg.bounded(stores.count())];
+    if (store.objects.isEmpty())
+      continue;
+    auto& obj    = store.objects[rg.bounded(store.objects.count())];
+    auto  center = obj.frame_m.center();
+    frames.append({center - QPointF{frame_size.width() / 2,
+                                    frame_size.height() / 2},
+                   frame_size});
+  }
+
+  qint64        scan_visited  = 0;
+  qint64        scan_found    = 0;
+  qint64        rtree_visited = 0;
+  qint64        rtree_found   = 0;
+  QElapsedTimer t;
+  t.start();
+  for (auto& frame: frames)
+    for (auto& store: stores)
+      for (auto& obj: store.objects)
+      {
+        scan_visited++;
+        if (KRTree::overlaps(obj.frame_m, frame))
+          scan_found++;
+      }
+  double scan_ms = t.nsecsElapsed() * 1e-6;
+
+  QVector<int> found;
+  t.restart();
+  for (auto& frame: frames)
+    for (auto& store: stores)
+    {
+      found.clear();
+      rtree_visited += store.rtree.search(frame, found);
+      rtree_found += found.count();
+    }
+  double rtree_ms = t.nsecsElapsed() * 1e-6;
+
+  int n = std::max(1, int(frames.count()));
+  qDebug() << "frames" << frames.count() << "mip" << mip
+           << "frame size m" << frame_size.width()
+           << frame_size.height();
+  qDebug() << "linear scan: visited per frame" << scan_visited / n
+           << "found" << scan_found / n << "ms" << scan_ms;
+  qDebug() << "r-tree: visited per frame" << rtree_visited / n
+           << "found" << rtree_found / n << "ms" << rtree_ms;
+  qDebug() << "visited ratio"
+           << 1.0 * scan_visited / std::max<qint64>(1, rtree_visited)
+           << "checksum" << (scan_found == rtree_found);
+  return 0;
+}
+
+int benchClasses(QString classes_path, int query_count)
+{
+  KPanClassManager class_man;
+  class_man.loadClasses(classes_path);
+  if (!class_man.getErrorStr().isEmpty())
+  {
+    qDebug() << "ERROR:" << class_man.getErrorStr();
+    return -1;
+  }
+  auto classes = class_man.getClasses();
+  if (classes.isEmpty())
+  {
+    qDebug() << "ERROR: no classes found in" << classes_path;
+    return -1;
+  }
+
+  struct Query
+  {
+    int         code = 0;
+    QString     key;
+    QStringList attr_names;
+    QStringList attr_values;
+  };
+
+  QVector<Query> queries;
+  auto           rg = QRandomGenerator(1);
+  for (int i = 0; i < query_count; i++)
+  {
+    auto  sh = classes[rg.bounded(classes.count())];
+    Query q;
+    q.code = sh->pan_code;
+    if (q.code == 0 || rg.bounded(4) == 0)
+      q.code = rg.bounded(1000000);
+    q.key = sh->pan_key;
+    if (rg.bounded(4) == 0)
+      q.key = classes[rg.bounded(classes.count())]->pan_key;
+    for (int j = 0; j < 8; j++)
+    {
+      auto other = classes[rg.bounded(classes.count())];
+      q.attr_names.append(other->attrname);
+      q.attr_values.append(other->attrval);
+    }
+    if (rg.bounded(2) == 0)
+    {
+      q.attr_names.append(sh->attrname);
+      q.attr_values.append(sh->attrval);
+    }
+    queries.append(q);
+  }
+
+  QVector<int>  linear_result(query_count);
+  QVector<int>  compiled_result(query_count);
+  QElapsedTimer t;
+  t.start();
+  for (int i = 0; auto& q: queries)
+    linear_result[i++] = class_man.getClassIdxLinear(
+        q.code, q.key, q.attr_names, q.attr_values);
+  double linear_s = t.nsecsElapsed() * 1e-9;
+
+  t.restart();
+  for (int i = 0; auto& q: queries)
+    compiled_result[i++] = class_man.getClassIdx(
+        q.code, q.key, q.attr_names, q.attr_values);
+  double compiled_s = t.nsecsElapsed() * 1e-9;
+
+  int mismatch_count = 0;
+  int matched_count  = 0;
+  for (int i = 0; i < query_count; i++)
+  {
+    if (linear_result[i] != compiled_result[i])
+      mismatch_count++;
+    if (linear_result[i] >= 0)
+      matched_count++;
+  }
+
+  qDebug() << "classes" << classes.count() << "queries" << query_count
+           << "matched" << matched_count;
+  qDebug() << "linear Mqueries/s" << query_count / linear_s * 1e-6;
+  qDebug() << "compiled Mqueries/s"
+           << query_count / compiled_s * 1e-6;
+  if (mismatch_count > 0)
+  {
+    qDebug() << "ERROR:" << mismatch_count << "mismatches";
+    return -1;
+  }
+  return 0;
+}
+
+int main(int argc, char* argv[])
+{
+  QCoreApplication a(argc, argv);
+
+  auto args = a.arguments();
+  if (args.count() > 2 && args[1] == "codec")
+    return benchCodec(args[2], args.value(3, "10").toInt());
+  if (args.count() > 2 && args[1] == "store")
+    return benchStore(args[2]);
+  if (args.count() > 1 && args[1] == "proj")
+    return benchProj(args.value(2, "1000000").toInt());
+  if (args.count() > 2 && args[1] == "rtree")
+    return benchRTree(args[2], args.value(3, "2").toDouble());
+  if (args.count() > 2 && args[1] == "classes")
+    return benchClasses(args[2], args.value(3, "1000000").toInt());
+
+  qDebug() << "usage:";
+  qDebug() << "  kbench codec <pack_dir> [repeat_count]";
+  qDebug() << "  kbench store <pack_dir>";
+  qDebug() << "  kbench proj [point_count]";
+  qDebug() << "  kbench rtree <pack_dir> [mip]";
+  qDebug() << "  kbench classes <classes.json> [query_count]";
+  return -1;
+}
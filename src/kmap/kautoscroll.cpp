@@ -31,6 +31,7 @@ void KAutoScroll::start()
   {
     speed = (pos_list.first() - pos_list.last()) / pos_list.count();
     timer.start();
+    flingStarted(speed * decay_coef / (1 - decay_coef));
   }
   else
   {
@@ -41,7 +42,7 @@ void KAutoScroll::start()
 
 void KAutoScroll::onTimer()
 {
-  speed *= 0.94;
+  speed *= decay_coef;
   if (speed.toPoint().manhattanLength() < 2)
     timer.stop();
   else
@@ -13,12 +13,14 @@ class KAutoScroll: public QObject
   QList<QPointF> pos_list;
   QTimer         timer;
   QPointF        speed;
+  double         decay_coef = 0.94;
   QElapsedTimer  mouse_pos_timer;
 
   void onTimer();
 
 signals:
   void scroll(QPoint);
+  void flingStarted(QPointF shift_pix);
 
 public:
   KAutoScroll();
@@ -7,18 +7,30 @@ QT += qml quick
 
 !linux-buildroot-g++: DEFINES += BUILD_WITH_SENSORS
 !android: DEFINES += BUILD_WITH_XMPP
+!android: DEFINES += BUILD_WITH_LZ4
 
 SOURCES += \
  ../lib/kbase.cpp \
  ../lib/kclass.cpp \
+ ../lib/kcodec.cpp \
  ../lib/kclassmanager.cpp \
  ../lib/kdatetime.cpp \
  ../lib/kfreeobjectmanager.cpp \
  ../lib/kobject.cpp \
 ../lib/klocker.cpp \
+ ../lib/kmemorymanager.cpp \
  ../lib/kpack.cpp \
+ ../lib/kpackwriter.cpp \
+ ../lib/kprojection.cpp \
 ../lib/krender.cpp \
  ../lib/krenderpack.cpp \
+ ../lib/kclip.cpp \
+ ../lib/klabelcache.cpp \
+ ../lib/klabelgrid.cpp \
+ ../lib/ktilecache.cpp \
+ ../lib/ktileloader.cpp \
+ ../lib/krtree.cpp \
+ ../lib/ktilestore.cpp \
  kautoscroll.cpp \
  kcontrols.cpp \
  keditwidget.cpp \
@@ -35,14 +47,25 @@ main.cpp
 HEADERS += \
  ../lib/kbase.h \
  ../lib/kclass.h \
+ ../lib/kcodec.h \
  ../lib/kclassmanager.h \
  ../lib/kdatetime.h \
  ../lib/kfreeobjectmanager.h \
 ../lib/klocker.h \
  ../lib/kobject.h \
+ ../lib/kmemorymanager.h \
  ../lib/kpack.h \
+ ../lib/kpackwriter.h \
+ ../lib/kprojection.h \
 ../lib/krender.h \
  ../lib/krenderpack.h \
+ ../lib/kclip.h \
+ ../lib/klabelcache.h \
+ ../lib/klabelgrid.h \
+ ../lib/ktilecache.h \
+ ../lib/ktileloader.h \
+ ../lib/krtree.h \
+ ../lib/ktilestore.h \
  kautoscroll.h \
  kcontrols.h \
  keditwidget.h \
@@ -80,6 +103,8 @@ kmucroombackend.h
     kpositionlabel.h \
 
 INCLUDEPATH += ../lib
+LIBS += -lz
+!android: LIBS += -llz4
 
 !android: LIBS += -lQXmppQt5
 
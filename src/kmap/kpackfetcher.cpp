@@ -4,7 +4,8 @@
 #include <QDir>
 #include <QDebug>
 
-KPackFetcher::KPackFetcher(QString _map_dir, const KPack* world_map)
+KPackFetcher::KPackFetcher(QString            _map_dir,
+                           const KRenderPack* world_map)
 {
   map_dir = _map_dir;
   QFile f(map_dir + "/maplist.txt");
@@ -14,18 +15,26 @@ KPackFetcher::KPackFetcher(QString _map_dir, const KPack* world_map)
     while (!in.atEnd())
       name_list.append(in.readLine());
   }
-  for (auto obj: world_map->main)
+  auto snapshot = world_map->getSnapshot();
+  if (!snapshot)
   {
+    qDebug() << "ERROR: world map is not loaded";
+    return;
+  }
+  auto& store = *snapshot->main_store;
+  for (auto& obj: store.objects)
+  {
+    auto iso_code_idx = store.findAttribute(obj, "iso_code");
     auto iso_code =
-        QString::fromUtf8(obj.attributes.value("iso_code")).toLower();
+        QString::fromUtf8(store.getString(iso_code_idx)).toLower();
     if (iso_code.isEmpty())
       continue;
 
     QVector<QPolygonF> polygons_m;
-    for (auto poly: obj.polygons)
-      polygons_m.append(poly.toPolygonM());
+    for (int i = 0; i < obj.polygon_count; i++)
+      polygons_m.append(store.getPolygonM(obj.first_polygon + i));
 
-    auto entry = LocalMapEntry{obj.frame.toRectM(), polygons_m};
+    auto entry = LocalMapEntry{obj.frame_m, polygons_m};
     if (name_list.contains(iso_code))
       iso_metrics_map[iso_code] = entry;
   }
@@ -17,6 +17,10 @@ KRenderWidget::KRenderWidget(Settings settings):
   r.setRenderWindowSizeCoef(settings.render_window_size_coef);
   max_zoom_speed = settings.max_zoom_speed;
   r.setMaxLoadedMapsCount(settings.max_loaded_maps_count);
+  r.setMapMemorySize(settings.map_memory_size);
+  r.setTileCacheSize(settings.tile_cache_size);
+  r.setTileCacheDir(settings.map_dir + "/tile_cache",
+                    settings.tile_cache_disk_size);
   r.setPixmapSize(size());
 
   setAttribute(Qt::WA_AcceptTouchEvents);
@@ -33,6 +37,8 @@ KRenderWidget::KRenderWidget(Settings settings):
           &KRenderWidget::paintUserObjects, Qt::DirectConnection);
   connect(&r, &KRender::started, this, &KRenderWidget::startedRender);
   connect(&r, &KRender::rendered, this, &KRenderWidget::onRendered);
+  connect(&r, &KRender::tileLoaded, this,
+          &KRenderWidget::onTileLoaded);
   scan(settings.map_dir);
 }
 
@@ -65,7 +71,7 @@ void KRenderWidget::addMap(QString path, bool load_now)
   r.addPack(path, load_now);
 }
 
-const KPack* KRenderWidget::getWorldPack()
+const KRenderPack* KRenderWidget::getWorldPack()
 {
   return r.getWorldPack();
 }
@@ -104,11 +110,18 @@ void KRenderWidget::onRendered(int ms_elapsed)
   modified();
 }
 
+void KRenderWidget::onTileLoaded()
+{
+  if (zoom_mode == None)
+    r.render();
+}
+
 void KRenderWidget::mousePressEvent(QMouseEvent* e)
 {
   if (!checkCanScroll())
     return;
   mousePressed(e->pos());
+  r.cancelPrefetch();
   mouse_pos        = e->pos();
   start_mouse_pos  = e->pos();
   zoom_focus_shift = QPoint();
@@ -200,6 +213,7 @@ bool KRenderWidget::event(QEvent* e)
         if (pg->state() == Qt::GestureStarted)
         {
           pinchStarted();
+          r.cancelPrefetch();
           focus_shift = pg->centerPoint().toPoint() -
                         QPoint{width() / 2, height() / 2};
           is_pinching = true;
@@ -346,9 +360,15 @@ void KRenderWidget::startZoom(KRenderWidget::ZoomMode mode,
   if (mode == Out)
     r.enableLoading(false);
   r.render();
+  r.prefetch(QPointF(), coef);
   zoom_timer.start();
 }
 
+void KRenderWidget::prefetchFling(QPointF shift_pix)
+{
+  r.prefetch(total_pan_pos + shift_pix, 1);
+}
+
 void KRenderWidget::zoomIn()
 {
   zoom_speed = 1.1;
@@ -28,6 +28,9 @@ public:
     int     update_interval_ms      = 100;
     double  max_zoom_speed          = 1.1;
     double  max_loaded_maps_count   = 3;
+    qint64  tile_cache_size         = 128 << 20;
+    qint64  tile_cache_disk_size    = 512 << 20;
+    qint64  map_memory_size         = 512 << 20;
   };
 
 private:
@@ -75,6 +78,7 @@ private:
 
   void   stepZoom();
   void   onRendered(int ms_elapsed);
+  void   onTileLoaded();
   void   startZoom(ZoomMode, QPoint focus_shift = QPoint());
   QPoint getTotalShift() const;
 
@@ -93,18 +97,19 @@ signals:
 
 public:
   KRenderWidget(Settings settings);
-  void         render();
-  void         renderUserObjects();
-  void         setViewPoint(const KGeoCoor& deg, double mip);
-  void         addMap(QString path, bool load_now);
-  const KPack* getWorldPack();
-  void         scroll(QPoint diff);
-  void         scrollTo(const KGeoCoor& coor);
-  void         zoomIn();
-  void         zoomOut();
-  QPoint       deg2scr(const KGeoCoor&) const;
-  QPoint       deg2pix(const KGeoCoor&) const;
-  KGeoCoor     scr2deg(const QPoint&) const;
-  double       getMip();
+  void               render();
+  void               renderUserObjects();
+  void               setViewPoint(const KGeoCoor& deg, double mip);
+  void               addMap(QString path, bool load_now);
+  const KRenderPack* getWorldPack();
+  void               scroll(QPoint diff);
+  void               scrollTo(const KGeoCoor& coor);
+  void               zoomIn();
+  void               zoomOut();
+  void               prefetchFling(QPointF shift_pix);
+  QPoint             deg2scr(const KGeoCoor&) const;
+  QPoint             deg2pix(const KGeoCoor&) const;
+  KGeoCoor           scr2deg(const QPoint&) const;
+  double             getMip();
 };
 #endif  // KRENDERWIDGET_H
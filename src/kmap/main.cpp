@@ -107,6 +107,9 @@ int main(int argc, char* argv[])
   mapw_settings.update_interval_ms      = 50;
   mapw_settings.max_zoom_speed          = 1.2;
   mapw_settings.max_loaded_maps_count   = 3;
+  mapw_settings.map_memory_size         = 512 << 20;
+  if (is_device)
+    mapw_settings.map_memory_size = 256 << 20;
 
   KRenderWidget      renderw(mapw_settings);
   KPackFetcher       map_fetcher(mapw_settings.map_dir,
@@ -158,6 +161,8 @@ int main(int argc, char* argv[])
                    &map_fetcher, &KPackFetcher::requestRect);
   QObject::connect(&auto_scroll, &KAutoScroll::scroll, &renderw,
                    &KRenderWidget::scroll);
+  QObject::connect(&auto_scroll, &KAutoScroll::flingStarted,
+                   &renderw, &KRenderWidget::prefetchFling);
 
   QObject::connect(&renderw, &KRenderWidget::mouseMoved, &object_man,
                    &KFreeObjectManager::movePoint);
@@ -1,7 +1,7 @@
 TEMPLATE = subdirs
 
 android: SUBDIRS += kmap
-else: SUBDIRS += pan2kpack kunite kmap
+else: SUBDIRS += pan2kpack kunite kmap kbench
 
 
 
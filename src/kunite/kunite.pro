@@ -2,11 +2,15 @@ QMAKE_CXXFLAGS += -std=c++2a
 QMAKE_CXXFLAGS += -Wno-deprecated-enum-enum-conversion
 
 INCLUDEPATH += ../lib
+LIBS += -lz -llz4
+DEFINES += BUILD_WITH_LZ4
 SOURCES += \
     ../lib/kbase.cpp \
     ../lib/klocker.cpp \
     ../lib/kpack.cpp \
+    ../lib/kpackwriter.cpp \
     ../lib/kclass.cpp \
+    ../lib/kcodec.cpp \
     ../lib/kobject.cpp \
     ../lib/kclassmanager.cpp \
     main.cpp
@@ -15,8 +19,10 @@ HEADERS += \
  ../lib/kbase.h \
     ../lib/klocker.h \
     ../lib/kpack.h \
+    ../lib/kpackwriter.h \
     ../lib/kserialize.h \
     ../lib/kclass.h \
+    ../lib/kcodec.h \
     ../lib/kclassmanager.cpp
 
 
@@ -1,35 +1,98 @@
 #include <QCoreApplication>
 #include <QDir>
+#include <QCommandLineParser>
 #include <QDebug>
-#include "kpack.h"
+#include "kpackwriter.h"
 
-class KWorldPack: public KPack
+struct KPackUniter
 {
-public:
-  void addPackToMainTile(const KPack&);
+  QHash<QString, int> class_idx_map;
+  qint64              skipped_count = 0;
+
+  void setClasses(const QVector<KClass>& classes);
+  bool loadPack(QString path, KPack& pack);
+  void addPack(QString path, KPack& pack, KPackWriter& writer);
+
+private:
+  QVector<int> getClassRemap(const QVector<KClass>& classes) const;
+  void         addObjects(QVector<KObject>&   objects,
+                          const QVector<int>& class_remap,
+                          KPackWriter&        writer);
 };
 
-void KWorldPack::addPackToMainTile(const KPack& m)
+void KPackUniter::setClasses(const QVector<KClass>& classes)
+{
+  class_idx_map.clear();
+  for (int i = -1; auto& cl: classes)
+  {
+    i++;
+    if (!class_idx_map.contains(cl.id))
+      class_idx_map.insert(cl.id, i);
+  }
+}
+
+QVector<int> KPackUniter::getClassRemap(
+    const QVector<KClass>& classes) const
+{
+  QVector<int> class_remap;
+  for (auto& cl: classes)
+  {
+    int idx = class_idx_map.value(cl.id, -1);
+    if (idx < 0)
+      qDebug() << "ERROR: class" << cl.id
+               << "not found in primary classifier!";
+    class_remap.append(idx);
+  }
+  return class_remap;
+}
+
+void KPackUniter::addObjects(QVector<KObject>&   objects,
+                             const QVector<int>& class_remap,
+                             KPackWriter&        writer)
 {
-  frame = frame.united(m.frame);
-  for (auto new_obj: m.main)
+  for (auto& obj: objects)
   {
-    auto new_cl = &m.classes[new_obj.class_idx];
-    bool found  = false;
-    for (int class_idx = -1; auto& cl: classes)
+    int class_idx = class_remap.value(obj.class_idx, -1);
+    if (class_idx < 0)
     {
-      class_idx++;
-      if (new_cl->id == cl.id)
-      {
-        new_obj.class_idx = class_idx;
-        found             = true;
-        break;
-      }
+      skipped_count++;
+      continue;
     }
-    if (!found)
-      qDebug() << "ERROR: class" << new_cl->id
-               << "not found in primary classifier!";
-    main.append(new_obj);
+    obj.class_idx = class_idx;
+    writer.addObject(obj);
+  }
+}
+
+bool KPackUniter::loadPack(QString path, KPack& pack)
+{
+  pack.loadMain(path, true, 0);
+  if (pack.main.status != KTile::Loading)
+  {
+    qDebug() << "ERROR: unable to load" << path;
+    return false;
+  }
+  return true;
+}
+
+void KPackUniter::addPack(QString path, KPack& pack,
+                          KPackWriter& writer)
+{
+  qDebug() << "adding" << path;
+  auto class_remap = getClassRemap(pack.classes);
+  addObjects(pack.main, class_remap, writer);
+  pack.main.clear();
+
+  for (int i = 0; i < pack.tiles.count(); i++)
+  {
+    if (pack.tiles[i].object_count == 0)
+      continue;
+    QVector<KObject> objects;
+    if (!pack.readTile(i, objects))
+    {
+      qDebug() << "ERROR: corrupted tile" << i << "in" << path;
+      continue;
+    }
+    addObjects(objects, class_remap, writer);
   }
 }
 
@@ -37,32 +100,101 @@ int main(int argc, char* argv[])
 {
   QCoreApplication a(argc, argv);
 
-  QDir dir(argv[1]);
+  QCommandLineParser parser;
+  parser.addHelpOption();
+  parser.addPositionalArgument("pack_dir", "source packs directory");
+  parser.addPositionalArgument("first_pack", "primary pack name");
+  parser.addPositionalArgument("result", "result pack path");
+  QCommandLineOption codec_option({"c", "codec"},
+                                  "block codec: zlib or lz4", "codec",
+                                  "zlib");
+  parser.addOption(codec_option);
+  QCommandLineOption memory_budget_option(
+      {"b", "memory-budget"}, "writer memory budget in MB",
+      "megabytes", "256");
+  parser.addOption(memory_budget_option);
+  parser.process(a);
+
+  auto args = parser.positionalArguments();
+  if (args.count() < 3)
+    parser.showHelp(-1);
+
+  KCodec::Type codec;
+  if (!KCodec::fromString(parser.value(codec_option), codec))
+  {
+    qDebug() << "ERROR: unknown codec" << parser.value(codec_option);
+    return -1;
+  }
+
+  QDir dir(args[0]);
   dir.setFilter(QDir::Files | QDir::NoSymLinks |
                 QDir::NoDotAndDotDot);
   auto fi_list = dir.entryInfoList();
 
-  auto result_path = argv[3];
+  auto result_path = args[2];
 
   QFile().remove(result_path);
 
-  QString    first_pack_path = QString(argv[1]) + "/" + argv[2];
-  KWorldPack united_pack;
-  united_pack.loadAll(first_pack_path, 0);
+  QString first_pack_path =
+      QFileInfo(args[0] + "/" + args[1]).absoluteFilePath();
 
+  QStringList pack_path_list = {first_pack_path};
   for (auto& fi: fi_list)
   {
     if (fi.suffix() != "kpack")
       continue;
-
     if (fi.absoluteFilePath() == first_pack_path)
       continue;
+    pack_path_list.append(fi.absoluteFilePath());
+  }
+
+  KPackUniter uniter;
+  KPack       first_pack;
+  if (!uniter.loadPack(first_pack_path, first_pack))
+    return -1;
+  if (first_pack.classes.isEmpty())
+  {
+    qDebug() << "ERROR: no classes in" << first_pack_path;
+    return -1;
+  }
 
-    qDebug() << "loading" << fi.absoluteFilePath();
+  KPack header;
+  header.codec    = codec;
+  header.main_mip = first_pack.main_mip;
+  header.tile_mip = first_pack.tile_mip;
+  header.frame    = first_pack.frame;
+  header.classes  = first_pack.classes;
+  header.borders  = first_pack.borders;
+  for (auto& path: pack_path_list)
+  {
     KPack pack;
-    pack.loadAll(fi.absoluteFilePath(), 0);
-    united_pack.addPackToMainTile(pack);
+    pack.loadMain(path, false, 0);
+    header.frame = header.frame.united(pack.frame);
   }
+
+  KPackWriter writer;
+  writer.setMemoryBudget(
+      qint64(std::max(1, parser.value(memory_budget_option).toInt()))
+      << 20);
+  if (!writer.open(result_path, header))
+    return -1;
+
+  uniter.setClasses(header.classes);
+  uniter.addPack(first_pack_path, first_pack, writer);
+  for (auto& path: pack_path_list.mid(1))
+  {
+    KPack pack;
+    if (uniter.loadPack(path, pack))
+      uniter.addPack(path, pack, writer);
+  }
+  if (uniter.skipped_count > 0)
+    qDebug() << "ERROR:" << uniter.skipped_count
+             << "objects skipped with unknown classes";
+
   qDebug() << "saving united pack...";
-  united_pack.save(result_path);
+  if (!writer.finish())
+    return -1;
+  qDebug() << "objects" << writer.getObjectCount() << "tiles"
+           << writer.getTileCount() << "spills"
+           << writer.getSpillCount();
 }
@@ -183,18 +183,24 @@ QRectF KGeoRect::toRectM() const
 }
 
 KGeoRect KGeoPolygon::getFrame() const
+{
+  return getFrame(constData(), count());
+}
+
+KGeoRect KGeoPolygon::getFrame(const KGeoCoor* coors, int count)
 {
   using namespace std;
   auto minx = numeric_limits<int>().max();
   auto miny = numeric_limits<int>().max();
   auto maxx = numeric_limits<int>().min();
   auto maxy = numeric_limits<int>().min();
-  for (auto& p: *this)
+  for (int i = 0; i < count; i++)
   {
-    minx = min(p.lon, minx);
-    miny = min(p.lat, miny);
-    maxx = max(p.lon, maxx);
-    maxy = max(p.lat, maxy);
+    auto& p = coors[i];
+    minx    = min(p.lon, minx);
+    miny    = min(p.lat, miny);
+    maxx    = max(p.lon, maxx);
+    maxy    = max(p.lat, maxy);
   }
   KGeoRect rect;
   rect.top_left.lon     = minx;
@@ -282,6 +288,66 @@ QPolygonF KGeoPolygon::toPolygonM()
   return ret;
 }
 
+KGeoPolygon KGeoPolygon::simplified(double tolerance_m,
+                                    int    min_count) const
+{
+  if (count() <= std::max(2, min_count))
+    return *this;
+
+  QVector<QPointF> points_m;
+  points_m.reserve(count());
+  for (auto& p: *this)
+    points_m.append(p.toMeters());
+
+  QVector<bool> keep(count(), false);
+  keep.first() = true;
+  keep.last()  = true;
+
+  QVector<QPair<int, int>> ranges = {{0, count() - 1}};
+  while (!ranges.isEmpty())
+  {
+    auto [start, end] = ranges.takeLast();
+    auto   a          = points_m[start];
+    auto   ab         = points_m[end] - a;
+    double ab_length  = sqrt(sqr(ab.x()) + sqr(ab.y()));
+
+    int    max_idx  = -1;
+    double max_dist = tolerance_m;
+    for (int i = start + 1; i < end; i++)
+    {
+      auto   ap   = points_m[i] - a;
+      double dist = 0;
+      if (ab_length > 0)
+        dist = fabs(ab.x() * ap.y() - ab.y() * ap.x()) / ab_length;
+      else
+        dist = sqrt(sqr(ap.x()) + sqr(ap.y()));
+      if (dist > max_dist)
+      {
+        max_dist = dist;
+        max_idx  = i;
+      }
+    }
+    if (max_idx < 0)
+      continue;
+    keep[max_idx] = true;
+    ranges.append({start, max_idx});
+    ranges.append({max_idx, end});
+  }
+
+  KGeoPolygon ret;
+  for (int i = 0; i < count(); i++)
+    if (keep[i])
+      ret.append(at(i));
+
+  if (ret.count() < min_count)
+  {
+    ret.clear();
+    for (int i = 0; i < min_count; i++)
+      ret.append(at(i * (count() - 1) / (min_count - 1)));
+  }
+  return ret;
+}
+
 void KGeoPolygon::load(const QByteArray& ba, int& pos,
                        int coor_precision_coef)
 {
@@ -64,10 +64,12 @@ struct KGeoRect
 
 struct KGeoPolygon: public QVector<KGeoCoor>
 {
-  KGeoRect getFrame() const;
+  static KGeoRect getFrame(const KGeoCoor* coors, int count);
+  KGeoRect        getFrame() const;
   void     save(QByteArray& ba, int coor_precision_coef) const;
   void load(const QByteArray& ba, int& pos, int coor_precision_coef);
-  QPolygonF toPolygonM();
+  QPolygonF   toPolygonM();
+  KGeoPolygon simplified(double tolerance_m, int min_count) const;
 };
 
 #endif  // KBASE_H
@@ -0,0 +1,147 @@
+#include "kclip.h"
+
+namespace
+{
+enum Edge
+{
+  Left,
+  Right,
+  Top,
+  Bottom
+};
+
+bool isInside(const QPointF& p, const QRectF& rect, Edge edge)
+{
+  switch (edge)
+  {
+  case Left:
+    return p.x() >= rect.left();
+  case Right:
+    return p.x() <= rect.right();
+  case Top:
+    return p.y() >= rect.top();
+  default:
+    return p.y() <= rect.bottom();
+  }
+}
+
+QPointF intersect(const QPointF& p1, const QPointF& p2,
+                  const QRectF& rect, Edge edge)
+{
+  auto d = p2 - p1;
+  switch (edge)
+  {
+  case Left:
+    return {rect.left(),
+            p1.y() + d.y() * (rect.left() - p1.x()) / d.x()};
+  case Right:
+    return {rect.right(),
+            p1.y() + d.y() * (rect.right() - p1.x()) / d.x()};
+  case Top:
+    return {p1.x() + d.x() * (rect.top() - p1.y()) / d.y(),
+            rect.top()};
+  default:
+    return {p1.x() + d.x() * (rect.bottom() - p1.y()) / d.y(),
+            rect.bottom()};
+  }
+}
+
+void clipEdge(const QVector<QPointF>& src, QVector<QPointF>& dst,
+              const QRectF& rect, Edge edge)
+{
+  dst.clear();
+  int count = src.count();
+  for (int i = 0; i < count; i++)
+  {
+    auto& prev    = src[(i + count - 1) % count];
+    auto& cur     = src[i];
+    bool  prev_in = isInside(prev, rect, edge);
+    bool  cur_in  = isInside(cur, rect, edge);
+    if (cur_in != prev_in)
+      dst.append(intersect(prev, cur, rect, edge));
+    if (cur_in)
+      dst.append(cur);
+  }
+}
+}
+
+namespace kmath
+{
+bool isInside(const QVector<QPointF>& points, const QRectF& rect)
+{
+  for (auto& p: points)
+    if (p.x() < rect.left() || p.x() > rect.right() ||
+        p.y() < rect.top() || p.y() > rect.bottom())
+      return false;
+  return true;
+}
+
+void clipPolygon(QVector<QPointF>& points, const QRectF& rect,
+                 QVector<QPointF>& buffer)
+{
+  for (auto edge: {Left, Right, Top, Bottom})
+  {
+    clipEdge(points, buffer, rect, edge);
+    std::swap(points, buffer);
+    if (points.isEmpty())
+      return;
+  }
+}
+
+bool clipSegment(QPointF& p1, QPointF& p2, const QRectF& rect)
+{
+  double dx    = p2.x() - p1.x();
+  double dy    = p2.y() - p1.y();
+  double p[4]  = {-dx, dx, -dy, dy};
+  double q[4]  = {p1.x() - rect.left(), rect.right() - p1.x(),
+                  p1.y() - rect.top(), rect.bottom() - p1.y()};
+  double t_min = 0;
+  double t_max = 1;
+  for (int i = 0; i < 4; i++)
+  {
+    if (p[i] == 0)
+    {
+      if (q[i] < 0)
+        return false;
+      continue;
+    }
+    double t = q[i] / p[i];
+    if (p[i] < 0)
+      t_min = std::max(t_min, t);
+    else
+      t_max = std::min(t_max, t);
+    if (t_min > t_max)
+      return false;
+  }
+  auto start = p1;
+  if (t_max < 1)
+    p2 = start + QPointF{dx, dy} * t_max;
+  if (t_min > 0)
+    p1 = start + QPointF{dx, dy} * t_min;
+  return true;
+}
+
+void clipPolyline(const QVector<QPointF>& points, const QRectF& rect,
+                  QVector<QVector<QPointF>>& pieces)
+{
+  pieces.clear();
+  QVector<QPointF> piece;
+  for (int i = 1; i < points.count(); i++)
+  {
+    auto p1 = points[i - 1];
+    auto p2 = points[i];
+    if (!clipSegment(p1, p2, rect))
+      continue;
+    if (!piece.isEmpty() && piece.last() != p1)
+    {
+      pieces.append(piece);
+      piece.clear();
+    }
+    if (piece.isEmpty())
+      piece.append(p1);
+    piece.append(p2);
+  }
+  if (piece.count() > 1)
+    pieces.append(piece);
+}
+}
@@ -0,0 +1,18 @@
+#ifndef KCLIP_H
+#define KCLIP_H
+
+#include <QPointF>
+#include <QRectF>
+#include <QVector>
+
+namespace kmath
+{
+bool isInside(const QVector<QPointF>& points, const QRectF& rect);
+bool clipSegment(QPointF& p1, QPointF& p2, const QRectF& rect);
+void clipPolygon(QVector<QPointF>& points, const QRectF& rect,
+                 QVector<QPointF>& buffer);
+void clipPolyline(const QVector<QPointF>& points, const QRectF& rect,
+                  QVector<QVector<QPointF>>& pieces);
+}
+
+#endif  // KCLIP_H
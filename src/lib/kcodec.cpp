@@ -0,0 +1,100 @@
+#include "kcodec.h"
+#include <QMetaEnum>
+#include <QDebug>
+#include <zlib.h>
+#ifdef BUILD_WITH_LZ4
+#include <lz4.h>
+#include <lz4hc.h>
+#endif
+
+bool KCodec::isSupported(Type codec)
+{
+#ifdef BUILD_WITH_LZ4
+  return codec == Zlib || codec == Lz4;
+#else
+  return codec == Zlib;
+#endif
+}
+
+QByteArray KCodec::compress(Type codec, const QByteArray& ba)
+{
+  if (!isSupported(codec))
+  {
+    qDebug() << "ERROR: unsupported codec" << toString(codec);
+    return QByteArray();
+  }
+#ifdef BUILD_WITH_LZ4
+  if (codec == Lz4)
+  {
+    QByteArray ret;
+    ret.resize(LZ4_compressBound(ba.count()));
+    int size = LZ4_compress_HC(ba.constData(), ret.data(), ba.count(),
+                               ret.count(), LZ4HC_CLEVEL_MAX);
+    ret.resize(size);
+    return ret;
+  }
+#endif
+  return qCompress(ba, 9);
+}
+
+qint64 KCodec::getMaxRawSize(Type codec, int size)
+{
+  // neither format can expand data beyond its best compression
+  // ratio, so a larger claimed raw size means a corrupt block
+  qint64 max_ratio = (codec == Lz4) ? 255 : 1032;
+  return std::min<qint64>(qint64(size) * max_ratio + 64, INT_MAX);
+}
+
+bool KCodec::uncompress(Type codec, const uchar* src, int size,
+                        int raw_size, QByteArray& dst)
+{
+  if (!isSupported(codec))
+  {
+    qDebug() << "ERROR: unsupported codec" << toString(codec);
+    return false;
+  }
+  if (size < 0)
+    return false;
+#ifdef BUILD_WITH_LZ4
+  if (codec == Lz4)
+  {
+    if (raw_size < 0 || raw_size > getMaxRawSize(codec, size))
+      return false;
+    dst.resize(raw_size);
+    return LZ4_decompress_safe((const char*)src, dst.data(), size,
+                               raw_size) == raw_size;
+  }
+#endif
+
+  if (size < 4)
+    return false;
+  uLong expected_size = (uLong(src[0]) << 24) | (uLong(src[1]) << 16) |
+                        (uLong(src[2]) << 8) | uLong(src[3]);
+  if (expected_size > uLong(getMaxRawSize(codec, size - 4)))
+    return false;
+  dst.resize(expected_size);
+  uLongf dst_size = expected_size;
+  if (::uncompress((Bytef*)dst.data(), &dst_size, src + 4, size - 4) !=
+      Z_OK)
+    return false;
+  return dst_size == expected_size;
+}
+
+bool KCodec::fromString(QString str, Type& codec)
+{
+  auto me = QMetaEnum::fromType<Type>();
+  for (int i = 0; i < me.keyCount(); i++)
+    if (QString(me.key(i)).toLower() == str.toLower() &&
+        isSupported(static_cast<Type>(me.value(i))))
+    {
+      codec = static_cast<Type>(me.value(i));
+      return true;
+    }
+  return false;
+}
+
+QString KCodec::toString(Type codec)
+{
+  return QString(QMetaEnum::fromType<Type>().valueToKey(codec))
+      .toLower();
+}
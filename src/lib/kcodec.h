@@ -0,0 +1,26 @@
+#ifndef KCODEC_H
+#define KCODEC_H
+
+#include <QObject>
+
+struct KCodec
+{
+  Q_GADGET
+public:
+  enum Type : uchar
+  {
+    Zlib,
+    Lz4
+  };
+  Q_ENUM(Type)
+
+  static bool       isSupported(Type codec);
+  static QByteArray compress(Type codec, const QByteArray& ba);
+  static bool       uncompress(Type codec, const uchar* src, int size,
+                               int raw_size, QByteArray& dst);
+  static qint64     getMaxRawSize(Type codec, int size);
+  static bool       fromString(QString str, Type& codec);
+  static QString    toString(Type codec);
+};
+
+#endif  // KCODEC_H
@@ -0,0 +1,90 @@
+#include "klabelcache.h"
+
+bool KLabelCache::Key::operator==(const Key& v) const
+{
+  return text == v.text && font_size_pix == v.font_size_pix &&
+         color == v.color && angle_deg == v.angle_deg &&
+         wrap_size == v.wrap_size && flags == v.flags;
+}
+
+uint qHash(const KLabelCache::Key& key, uint seed)
+{
+  return qHash(key.text, seed) ^ qHash(key.font_size_pix) * 31 ^
+         qHash(key.color) * 131 ^ qHash(key.angle_deg) * 251 ^
+         qHash(key.wrap_size.width() * 65536 +
+               key.wrap_size.height()) ^
+         qHash(key.flags) * 17;
+}
+
+qint64 KLabelCache::Sprite::getSize() const
+{
+  return image.sizeInBytes();
+}
+
+void KLabelCache::setMaxSize(qint64 bytes)
+{
+  max_size = bytes;
+  while (size > max_size && !items.empty())
+  {
+    auto& item = items.back();
+    size -= item.sprite.getSize();
+    item_map.remove(item.key);
+    items.pop_back();
+  }
+}
+
+bool KLabelCache::find(const Key& key, Sprite& sprite)
+{
+  auto it = item_map.find(key);
+  if (it == item_map.end())
+  {
+    miss_count++;
+    return false;
+  }
+  hit_count++;
+  items.splice(items.begin(), items, it.value());
+  sprite = items.front().sprite;
+  return true;
+}
+
+void KLabelCache::insert(const Key& key, const Sprite& sprite)
+{
+  if (auto it = item_map.find(key); it != item_map.end())
+  {
+    size -= it.value()->sprite.getSize();
+    items.erase(it.value());
+    item_map.erase(it);
+  }
+  items.push_front({key, sprite});
+  item_map.insert(key, items.begin());
+  size += sprite.getSize();
+  setMaxSize(max_size);
+}
+
+void KLabelCache::clear()
+{
+  items.clear();
+  item_map.clear();
+  size = 0;
+}
+
+qint64 KLabelCache::getSize() const
+{
+  return size;
+}
+
+int KLabelCache::getHitCount() const
+{
+  return hit_count;
+}
+
+int KLabelCache::getMissCount() const
+{
+  return miss_count;
+}
+
+void KLabelCache::resetCounters()
+{
+  hit_count  = 0;
+  miss_count = 0;
+}
@@ -0,0 +1,56 @@
+#ifndef KLABELCACHE_H
+#define KLABELCACHE_H
+
+#include <QImage>
+#include <QHash>
+#include <list>
+
+class KLabelCache
+{
+public:
+  struct Key
+  {
+    QString text;
+    int     font_size_pix = 0;
+    QRgb    color         = 0;
+    int     angle_deg     = 0;
+    QSize   wrap_size;
+    int     flags         = 0;
+    bool    operator==(const Key&) const;
+  };
+
+  struct Sprite
+  {
+    QImage image;
+    QPoint origin;
+    qint64 getSize() const;
+  };
+
+private:
+  struct Item
+  {
+    Key    key;
+    Sprite sprite;
+  };
+
+  qint64                                max_size = 16 << 20;
+  qint64                                size     = 0;
+  std::list<Item>                       items;
+  QHash<Key, std::list<Item>::iterator> item_map;
+  int                                   hit_count  = 0;
+  int                                   miss_count = 0;
+
+public:
+  void   setMaxSize(qint64 bytes);
+  bool   find(const Key& key, Sprite& sprite);
+  void   insert(const Key& key, const Sprite& sprite);
+  void   clear();
+  qint64 getSize() const;
+  int    getHitCount() const;
+  int    getMissCount() const;
+  void   resetCounters();
+};
+
+uint qHash(const KLabelCache::Key& key, uint seed = 0);
+
+#endif  // KLABELCACHE_H
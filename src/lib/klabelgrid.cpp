@@ -0,0 +1,62 @@
+#include "klabelgrid.h"
+
+void KLabelGrid::init(QRect _rect, int _cell_size_pix)
+{
+  rect          = _rect;
+  cell_size_pix = _cell_size_pix;
+  cols          = (rect.width() + cell_size_pix - 1) / cell_size_pix;
+  rows          = (rect.height() + cell_size_pix - 1) / cell_size_pix;
+  cells.resize(cols * rows);
+  clear();
+}
+
+void KLabelGrid::clear()
+{
+  for (auto& cell: cells)
+    cell.clear();
+  rects.clear();
+}
+
+QRect KLabelGrid::getCellRange(const QRect& r) const
+{
+  auto visible_rect = r.intersected(rect);
+  if (visible_rect.isEmpty())
+    return QRect();
+  auto top_left     = visible_rect.topLeft() - rect.topLeft();
+  auto bottom_right = visible_rect.bottomRight() - rect.topLeft();
+  return {QPoint{top_left.x() / cell_size_pix,
+                 top_left.y() / cell_size_pix},
+          QPoint{bottom_right.x() / cell_size_pix,
+                 bottom_right.y() / cell_size_pix}};
+}
+
+bool KLabelGrid::intersects(const QRect& r) const
+{
+  auto range = getCellRange(r);
+  for (int row = range.top(); row <= range.bottom(); row++)
+    for (int col = range.left(); col <= range.right(); col++)
+      for (auto idx: cells[row * cols + col])
+        if (rects[idx].intersects(r))
+          return true;
+  return false;
+}
+
+void KLabelGrid::insert(const QRect& r)
+{
+  auto range = getCellRange(r);
+  if (range.isEmpty())
+    return;
+  int idx = rects.count();
+  rects.append(r);
+  for (int row = range.top(); row <= range.bottom(); row++)
+    for (int col = range.left(); col <= range.right(); col++)
+      cells[row * cols + col].append(idx);
+}
+
+bool KLabelGrid::tryInsert(const QRect& r)
+{
+  if (intersects(r))
+    return false;
+  insert(r);
+  return true;
+}
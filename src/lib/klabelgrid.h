@@ -0,0 +1,24 @@
+#ifndef KLABELGRID_H
+#define KLABELGRID_H
+
+#include <QRect>
+#include <QVector>
+
+struct KLabelGrid
+{
+  QRect                 rect;
+  int                   cell_size_pix = 64;
+  int                   cols          = 0;
+  int                   rows          = 0;
+  QVector<QVector<int>> cells;
+  QVector<QRect>        rects;
+
+  void  init(QRect rect, int cell_size_pix);
+  void  clear();
+  QRect getCellRange(const QRect& r) const;
+  bool  intersects(const QRect& r) const;
+  void  insert(const QRect& r);
+  bool  tryInsert(const QRect& r);
+};
+
+#endif  // KLABELGRID_H
@@ -0,0 +1,109 @@
+#include "kmemorymanager.h"
+#include <QDebug>
+
+void KMemoryManager::setMaxSize(qint64 bytes)
+{
+  max_size = bytes;
+}
+
+qint64 KMemoryManager::getMaxSize() const
+{
+  return max_size;
+}
+
+KMemoryManager::Usage KMemoryManager::getUsage() const
+{
+  return usage;
+}
+
+void KMemoryManager::addEntries(KRenderPack* pack, bool is_world,
+                                QVector<Entry>& entries)
+{
+  auto snapshot = pack->getSnapshot();
+  if (!snapshot)
+    return;
+
+  Entry main_entry;
+  main_entry.pack      = pack;
+  main_entry.size      = snapshot->main_store->getMemorySize();
+  main_entry.last_used = pack->getLastUsed(-1);
+  usage.size += main_entry.size;
+  usage.main_count++;
+  if (!is_world)
+    entries.append(main_entry);
+
+  for (int tile_idx = -1; auto& store: snapshot->tile_stores)
+  {
+    tile_idx++;
+    if (!store)
+      continue;
+    Entry entry;
+    entry.pack      = pack;
+    entry.tile_idx  = tile_idx;
+    entry.size      = store->getMemorySize();
+    entry.last_used = pack->getLastUsed(tile_idx);
+    usage.size += entry.size;
+    usage.tile_count++;
+    entries.append(entry);
+  }
+}
+
+bool KMemoryManager::collect(const KRenderPackCollection& packs,
+                             qint64                       keep_stamp)
+{
+  usage = Usage();
+  QVector<Entry> entries;
+  for (int i = -1; auto pack: packs)
+  {
+    i++;
+    addEntries(pack, i == 0, entries);
+  }
+  if (usage.size <= max_size)
+    return false;
+
+  std::sort(entries.begin(), entries.end(),
+            [](const Entry& a, const Entry& b)
+            {
+              if ((a.tile_idx < 0) != (b.tile_idx < 0))
+                return b.tile_idx < 0;
+              return a.last_used < b.last_used;
+            });
+
+  bool   has_evicted = false;
+  qint64 size        = usage.size;
+  for (auto& entry: entries)
+  {
+    if (size <= max_size)
+      break;
+    if (entry.last_used >= keep_stamp)
+      continue;
+    if (entry.tile_idx < 0)
+    {
+      qint64 pack_size = entry.pack->getMemorySize();
+      if (!entry.pack->clear())
+        continue;
+      size -= pack_size;
+    }
+    else
+    {
+      if (!entry.pack->unloadTile(entry.tile_idx))
+        continue;
+      size -= entry.size;
+    }
+    has_evicted = true;
+  }
+  if (!has_evicted)
+    return false;
+
+  usage = Usage();
+  entries.clear();
+  for (int i = -1; auto pack: packs)
+  {
+    i++;
+    addEntries(pack, i == 0, entries);
+  }
+  qDebug() << "map memory" << usage.size / 1024 / 1024 << "MB of"
+           << max_size / 1024 / 1024 << "MB," << usage.main_count
+           << "packs," << usage.tile_count << "tiles";
+  return has_evicted;
+}
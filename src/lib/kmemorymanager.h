@@ -0,0 +1,39 @@
+#ifndef KMEMORYMANAGER_H
+#define KMEMORYMANAGER_H
+
+#include "krenderpack.h"
+
+class KMemoryManager
+{
+public:
+  struct Usage
+  {
+    qint64 size       = 0;
+    int    main_count = 0;
+    int    tile_count = 0;
+  };
+
+private:
+  struct Entry
+  {
+    KRenderPack* pack      = nullptr;
+    int          tile_idx  = -1;
+    qint64       size      = 0;
+    qint64       last_used = 0;
+  };
+
+  qint64 max_size = 512 << 20;
+  Usage  usage;
+
+  void addEntries(KRenderPack* pack, bool is_world,
+                  QVector<Entry>& entries);
+
+public:
+  void   setMaxSize(qint64 bytes);
+  qint64 getMaxSize() const;
+  Usage  getUsage() const;
+  bool   collect(const KRenderPackCollection& packs,
+                 qint64                       keep_stamp);
+};
+
+#endif  // KMEMORYMANAGER_H
@@ -4,8 +4,8 @@
 #include "kobject.h"
 #include "kserialize.h"
 
-void KObject::load(QVector<KClass>& class_list, int& pos,
-                   const QByteArray& ba)
+void KObject::load(const QVector<KClass>& class_list, int& pos,
+                   const QByteArray& ba, int format_version)
 {
   using namespace KSerialize;
 
@@ -58,6 +58,61 @@ void KObject::load(QVector<KClass>& class_list, int& pos,
     polygons[0].load(ba, pos, cl->coor_precision_coef);
     frame = polygons[0].getFrame();
   }
+
+  if (format_version < 4)
+    return;
+
+  uchar lod_count;
+  read(ba, pos, lod_count);
+  lods.resize(lod_count);
+  for (auto& lod: lods)
+  {
+    uchar level;
+    read(ba, pos, level);
+    lod.level = level;
+    lod.polygons.resize(polygons.count());
+    for (auto& polygon: lod.polygons)
+      polygon.load(ba, pos, cl->coor_precision_coef);
+  }
+}
+
+double KObject::getLodToleranceM(int level)
+{
+  if (level <= 0)
+    return 0;
+  return min_lod_tolerance_m * pow(4, level - 1);
+}
+
+void KObject::buildLods(const QVector<KClass>& class_list)
+{
+  lods.clear();
+  auto type = class_list[class_idx].type;
+  if (type != KClass::Line && type != KClass::Polygon)
+    return;
+
+  int min_count  = (type == KClass::Polygon) ? 4 : 2;
+  int prev_count = 0;
+  for (auto& polygon: polygons)
+    prev_count += polygon.count();
+
+  auto prev_polygons = polygons;
+  for (int level = 1; level <= max_lod_level; level++)
+  {
+    KObjectLod lod;
+    lod.level       = level;
+    int point_count = 0;
+    for (auto& polygon: prev_polygons)
+    {
+      lod.polygons.append(
+          polygon.simplified(getLodToleranceM(level), min_count));
+      point_count += lod.polygons.last().count();
+    }
+    if (point_count > prev_count * 3 / 4)
+      continue;
+    lods.append(lod);
+    prev_polygons = lod.polygons;
+    prev_count    = point_count;
+  }
 }
 
 KGeoCoor KObject::getCenter()
@@ -104,6 +159,14 @@ void KObject::save(const QVector<KClass>& class_list,
     for (auto& polygon: polygons)
       polygon.save(ba, cl->coor_precision_coef);
   }
+
+  write(ba, (uchar)lods.count());
+  for (auto& lod: lods)
+  {
+    write(ba, (uchar)lod.level);
+    for (auto& polygon: lod.polygons)
+      polygon.save(ba, cl->coor_precision_coef);
+  }
 }
 
 KFreeObject::KFreeObject(KObject src_obj)
@@ -4,19 +4,31 @@
 #include <QMap>
 #include "kclass.h"
 
+struct KObjectLod
+{
+  int                  level = 0;
+  QVector<KGeoPolygon> polygons;
+};
+
 struct KObject
 {
+  static constexpr int    max_lod_level       = 6;
+  static constexpr double min_lod_tolerance_m = 8;
+
   int                       class_idx = 0;
   QString                   name;
   QMap<QString, QByteArray> attributes;
   KGeoRect                  frame;
   QVector<KGeoPolygon>      polygons;
+  QVector<KObjectLod>       lods;
 
 public:
   void save(const QVector<KClass>& class_list, QByteArray& ba) const;
-  void load(QVector<KClass>& class_list, int& pos,
-            const QByteArray& ba);
-  KGeoCoor getCenter();
+  void load(const QVector<KClass>& class_list, int& pos,
+            const QByteArray& ba, int format_version);
+  void buildLods(const QVector<KClass>& class_list);
+  KGeoCoor      getCenter();
+  static double getLodToleranceM(int level);
 };
 
 struct KFreeObject: public KObject
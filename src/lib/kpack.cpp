@@ -7,6 +7,8 @@
 #include <QDateTime>
 #include <QRegularExpression>
 
+thread_local QByteArray KPack::block_buffer;
+
 void KPack::clear()
 {
   if (main.status != KTile::Loaded)
@@ -17,87 +19,73 @@ void KPack::clear()
   main.clear();
   tiles.clear();
   classes.clear();
+  closeFile();
   main.status = KTile::Null;
 }
 
-qint64 KPack::count()
-{
-  qint64 total_count = main.count();
-  for (auto t: tiles)
-    total_count += t.count();
-  return total_count;
-}
-
-void KPack::save(QString path) const
+bool KPack::openFile(QString path)
 {
-  using namespace KSerialize;
-
-  QFile f(path);
-  if (!f.open(QIODevice::WriteOnly))
+  if (file_data)
+    return true;
+  file.setFileName(path);
+  if (!file.open(QIODevice::ReadOnly))
   {
-    qDebug() << "write error:" << path;
-    return;
+    qDebug() << "read error:" << path;
+    return false;
   }
-
-  write(&f, QString("kpack"));
-  write(&f, frame);
-  char has_borders = (borders.count() > 0);
-  write(&f, has_borders);
-
-  if (has_borders)
+  file_size = file.size();
+  file_data = file.map(0, file_size);
+  if (!file_data)
   {
-    QByteArray ba;
-    write(ba, borders.count());
-    for (auto border: borders)
-      border.save(ba, border_coor_precision_coef);
-    ba = qCompress(ba, 9);
-    write(&f, ba.count());
-    f.write(ba.data(), ba.count());
+    file_copy = file.readAll();
+    file.seek(0);
+    file_data = (const uchar*)file_copy.constData();
   }
+  return true;
+}
 
-  write(&f, main_mip);
-  write(&f, tile_mip);
-  write(&f, classes.count());
-  for (auto cl: classes)
-    cl.save(&f);
-
-  QByteArray ba;
-  ba = qCompress(ba, 9);
-  write(&f, ba.count());
-  f.write(ba.data(), ba.count());
+void KPack::closeFile()
+{
+  file.close();
+  file_copy.clear();
+  file_data = nullptr;
+  file_size = 0;
+}
 
-  write(&f, main.count());
-  ba.clear();
+bool KPack::uncompressBlock(KCodec::Type codec, qint64 pos,
+                            int size, int raw_size,
+                            QByteArray& dst) const
+{
+  if (size < 0 || pos + size > file_size)
+    return false;
+  return KCodec::uncompress(codec, &file_data[pos], size, raw_size,
+                            dst);
+}
 
-  for (auto& obj: main)
-    obj.save(classes, ba);
-  ba = qCompress(ba, 9);
-  write(&f, ba.count());
-  f.write(ba.data(), ba.count());
-  write(&f, tiles.count());
-  QList<qint64> small_part_pos_list;
-
-  for (int part_idx = 0; auto& tile: tiles)
+bool KPack::readBlock(QByteArray& dst)
+{
+  using namespace KSerialize;
+  auto         f           = &file;
+  KCodec::Type block_codec = KCodec::Zlib;
+  int          raw_size    = 0;
+  int          size        = 0;
+  if (format_version >= 3)
   {
-    small_part_pos_list.append(f.pos());
-    if (tile.count() > 0)
-    {
-      write(&f, tile.count());
-      ba.clear();
-      for (auto& obj: tile)
-        obj.save(classes, ba);
-      ba = qCompress(ba, 9);
-      write(&f, ba.count());
-      f.write(ba.data(), ba.count());
-    }
-    else
-      write(&f, 0);
-    part_idx++;
+    read(f, block_codec);
+    read(f, raw_size);
   }
-  auto small_idx_start_pos = f.pos();
-  for (auto& pos: small_part_pos_list)
-    write(&f, pos);
-  write(&f, small_idx_start_pos);
+  read(f, size);
+  auto pos = f->pos();
+  f->seek(pos + size);
+  return uncompressBlock(block_codec, pos, size, raw_size, dst);
+}
+
+qint64 KPack::count()
+{
+  qint64 total_count = main.count();
+  for (auto t: tiles)
+    total_count += t.count();
+  return total_count;
 }
 
 void KPack::loadMain(QString path, bool load_objects,
@@ -109,89 +97,209 @@ void KPack::loadMain(QString path, bool load_objects,
   t.start();
 
   using namespace KSerialize;
-  QFile f(path);
-  if (!f.open(QIODevice::ReadOnly))
+  if (main.status != KTile::Null)
+    return;
+  if (!openFile(path))
+    return;
+  auto f = &file;
+  f->seek(0);
+
+  QString format_id;
+  read(f, format_id);
+  if (!format_id.startsWith("kpack"))
   {
-    qDebug() << "read error:" << path;
+    qDebug() << "ERROR: unknown format" << format_id << "in" << path;
+    closeFile();
     return;
   }
-
-  if (main.status != KTile::Null)
+  format_version = std::max(1, format_id.mid(5).toInt());
+  if (format_version > current_format_version)
+  {
+    qDebug() << "ERROR: unsupported format" << format_id << "in"
+             << path;
+    closeFile();
     return;
+  }
+  read(f, frame);
 
-  QString format_id;
-  read(&f, format_id);
-  read(&f, frame);
+  int tile_count = 0;
+  if (format_version >= 2)
+  {
+    read(f, main_mip);
+    read(f, tile_mip);
+    read(f, tile_cols);
+    read(f, tile_rows);
+    read(f, tile_count);
+    qint64 pos = f->pos();
+    bool   ok  = tile_count >= 0 && tile_count <= file_size - pos;
+    if (ok)
+      tiles.resize(tile_count);
+    for (auto& tile: tiles)
+    {
+      ok = ok && read(file_data, file_size, pos, tile.pos) &&
+           read(file_data, file_size, pos, tile.size) &&
+           read(file_data, file_size, pos, tile.raw_size) &&
+           read(file_data, file_size, pos, tile.frame) &&
+           read(file_data, file_size, pos, tile.object_count);
+      if (format_version >= 3)
+        ok = ok && read(file_data, file_size, pos, tile.codec);
+      ok = ok && isTileInFile(tile);
+    }
+    if (!ok)
+    {
+      qDebug() << "ERROR: corrupted tile table in" << path;
+      tiles.clear();
+      closeFile();
+      return;
+    }
+    f->seek(pos);
+  }
 
   char has_borders = false;
-  read(&f, has_borders);
+  read(f, has_borders);
   if (has_borders)
   {
-    QByteArray ba;
-    int        ba_count = 0;
-    read(&f, ba_count);
-    ba.resize(ba_count);
-    f.read(ba.data(), ba_count);
-    ba      = qUncompress(ba);
-    int pos = 0;
-    int borders_count;
-    read(ba, pos, borders_count);
-    borders.resize(borders_count);
-    for (auto& border: borders)
-      border.load(ba, pos, border_coor_precision_coef);
-    borders_m.clear();
-    for (auto border: borders)
+    auto& ba = block_buffer;
+    if (!readBlock(ba))
+      ba.clear();
+    int pos           = 0;
+    int borders_count = 0;
+    if (!ba.isEmpty() && borders.isEmpty())
+      read(ba, pos, borders_count);
+    if (borders_count > 0)
     {
-      QPolygonF border_m = border.toPolygonM();
-      if (!border_m.isEmpty())
-        borders_m.append(border_m);
+      borders.resize(borders_count);
+      for (auto& border: borders)
+        border.load(ba, pos, border_coor_precision_coef);
+      for (auto border: borders)
+      {
+        QPolygonF border_m = border.toPolygonM();
+        if (!border_m.isEmpty())
+          borders_m.append(border_m);
+      }
     }
   }
 
-  read(&f, main_mip);
-  read(&f, tile_mip);
+  if (format_version == 1)
+  {
+    read(f, main_mip);
+    read(f, tile_mip);
+  }
 
   if (!load_objects)
+  {
+    tiles.clear();
+    closeFile();
     return;
+  }
 
   qDebug() << "loading main from" << path;
   main.status = KTile::Loading;
   int class_count;
-  read(&f, class_count);
+  read(f, class_count);
   qDebug() << "class_count" << class_count;
   for (int i = 0; i < class_count; i++)
   {
     KClass cl;
-    cl.load(&f, pixel_size_mm);
+    cl.load(f, pixel_size_mm);
     classes.append(cl);
   }
 
   int ba_count = 0;
-  read(&f, ba_count);
-  QByteArray ba;
-  ba.resize(ba_count);
-  f.read(ba.data(), ba_count);
-  ba = qUncompress(ba);
-
-  int pos = 0;
+  if (format_version == 1)
+  {
+    read(f, ba_count);
+    f->seek(f->pos() + ba_count);
+  }
 
   int big_obj_count;
-  read(&f, big_obj_count);
+  read(f, big_obj_count);
   main.resize(big_obj_count);
 
-  ba.clear();
-  ba_count = 0;
-  read(&f, ba_count);
-  ba.resize(ba_count);
-  f.read(ba.data(), ba_count);
-  ba  = qUncompress(ba);
-  pos = 0;
+  auto& ba = block_buffer;
+  if (!readBlock(ba))
+  {
+    qDebug() << "ERROR: corrupted main block in" << path;
+    main.clear();
+  }
+  int pos = 0;
   for (auto& obj: main)
-    obj.load(classes, pos, ba);
+    obj.load(classes, pos, ba, format_version);
+
+  if (format_version == 1 && !loadTileIndexV1())
+  {
+    qDebug() << "ERROR: corrupted tile index in" << path;
+    main.clear();
+    tiles.clear();
+    classes.clear();
+    closeFile();
+    main.status = KTile::Null;
+  }
+}
+
+bool KPack::isTileInFile(const KTile& tile) const
+{
+  return tile.pos >= 0 && tile.size >= 0 &&
+         tile.pos <= file_size - tile.size;
+}
+
+bool KPack::loadTileIndexV1()
+{
+  using namespace KSerialize;
+  int tile_count = 0;
+  read(&file, tile_count);
+  if (tile_count < 0 || tile_count > file_size)
+    return false;
+  tiles.resize(tile_count);
+  tile_cols = sqrt(tile_count);
+  tile_rows = tile_cols;
+
+  qint64 small_idx_start_pos = 0;
+  qint64 pos                 = file_size - sizeof(qint64);
+  if (!read(file_data, file_size, pos, small_idx_start_pos))
+    return false;
+
+  int calc_small_part_count =
+      (file_size - sizeof(qint64) - small_idx_start_pos) /
+      sizeof(qint64);
+  if (calc_small_part_count != tiles.count())
+    return true;
+
+  pos = small_idx_start_pos;
+  for (auto& tile: tiles)
+  {
+    if (!read(file_data, file_size, pos, tile.pos))
+      return false;
+    qint64 tile_pos = tile.pos;
+    if (!read(file_data, file_size, tile_pos, tile.object_count))
+      return false;
+    if (tile.object_count > 0 &&
+        !read(file_data, file_size, tile_pos, tile.size))
+      return false;
+    tile.pos = tile_pos;
+    if (!isTileInFile(tile))
+      return false;
+  }
+  return true;
+}
 
-  int small_count;
-  read(&f, small_count);
-  tiles.resize(small_count);
+QRectF KPack::getTileRectM(int tile_idx) const
+{
+  auto& tile = tiles[tile_idx];
+  if (format_version >= 2)
+  {
+    auto rect_m = tile.frame.toRectM().normalized();
+    rect_m.adjust(-1, -1, 1, 1);
+    return rect_m;
+  }
+  auto   map_rect_m  = frame.toMeters();
+  QSizeF tile_size_m = {map_rect_m.width() / tile_cols,
+                        map_rect_m.height() / tile_rows};
+  int    tile_idx_y  = tile_idx / tile_cols;
+  int    tile_idx_x  = tile_idx - tile_idx_y * tile_cols;
+  double tile_left = map_rect_m.x() + tile_idx_x * tile_size_m.width();
+  double tile_top = map_rect_m.y() + tile_idx_y * tile_size_m.height();
+  return {{tile_left, tile_top}, tile_size_m};
 }
 
 void KPack::loadAll(QString path, double pixel_size_mm)
@@ -205,57 +313,39 @@ void KPack::loadTile(QString path, int tile_idx)
 {
   if (main.status != KTile::Loaded)
     return;
-  if (tiles[tile_idx].status == KTile::Loading)
+  if (tile_idx > tiles.count() - 1)
     return;
-
-  qDebug() << "loading tile" << tile_idx << "from" << path;
-  QElapsedTimer t;
-  t.start();
-  using namespace KSerialize;
-  QFile f(path);
-  if (!f.open(QIODevice::ReadOnly))
-  {
-    qDebug() << "read error:" << path;
+  auto& tile = tiles[tile_idx];
+  if (tile.status == KTile::Loading)
     return;
-  }
-
-  qint64 small_idx_start_pos;
-  f.seek(f.size() - sizeof(qint64));
-  read(&f, small_idx_start_pos);
-
-  int calc_small_part_count =
-      (f.size() - sizeof(qint64) - small_idx_start_pos) /
-      sizeof(qint64);
-  if (calc_small_part_count != tiles.count())
+  if (tile.object_count == 0)
     return;
 
-  if (tile_idx > tiles.count() - 1)
+  qDebug() << "loading tile" << tile_idx << "from" << path;
+  if (!openFile(path))
     return;
 
-  f.seek(small_idx_start_pos + tile_idx * sizeof(qint64));
-  qint64 part_pos;
-  read(&f, part_pos);
-  f.seek(part_pos);
-
-  int part_obj_count;
-  read(&f, part_obj_count);
-
-  if (part_obj_count == 0)
-    return;
+  tile.status = KTile::Loading;
+  if (!readTile(tile_idx, tile))
+  {
+    qDebug() << "ERROR: corrupted tile" << tile_idx << "in" << path;
+    tile.clear();
+  }
+}
 
-  tiles[tile_idx].resize(part_obj_count);
+bool KPack::readTile(int tile_idx, QVector<KObject>& objects) const
+{
+  auto& tile = tiles[tile_idx];
+  auto& ba   = block_buffer;
+  if (!uncompressBlock(tile.codec, tile.pos, tile.size,
+                       tile.raw_size, ba))
+    return false;
 
-  int ba_count = 0;
-  read(&f, ba_count);
-  QByteArray ba;
-  ba.resize(ba_count);
-  f.read(ba.data(), ba_count);
-  ba = qUncompress(ba);
-
-  tiles[tile_idx].status = KTile::Loading;
-  int pos                = 0;
-  for (auto& obj: tiles[tile_idx])
-    obj.load(classes, pos, ba);
+  objects.resize(tile.object_count);
+  int pos = 0;
+  for (auto& obj: objects)
+    obj.load(classes, pos, ba, format_version);
+  return true;
 }
 
 void KPack::addObject(KFreeObject free_obj)
@@ -8,7 +8,9 @@
 #include <QMap>
 #include <QElapsedTimer>
 #include <QVariant>
+#include <QFile>
 #include "kobject.h"
+#include "kcodec.h"
 
 struct KTile: public QVector<KObject>
 {
@@ -18,15 +20,30 @@ struct KTile: public QVector<KObject>
     Loading,
     Loaded
   };
-  Status status = Null;
+  Status       status = Null;
+  KGeoRect     frame;
+  int          object_count = 0;
+  qint64       pos          = 0;
+  int          size         = 0;
+  int          raw_size     = 0;
+  KCodec::Type codec        = KCodec::Zlib;
 };
 
 struct KPack
 {
   static constexpr int border_coor_precision_coef = 10000;
+  static constexpr int current_format_version     = 4;
+  static constexpr int tile_entry_size =
+      sizeof(qint64) + 3 * sizeof(int) + sizeof(KGeoRect) +
+      sizeof(uchar);
 
-  double main_mip = 0;
-  double tile_mip = 0;
+  int          format_version = 0;
+  double       main_mip       = 0;
+  double       tile_mip       = 0;
+  // tile grid of format 1; formats 2+ keep zero placeholders here
+  int          tile_cols      = 0;
+  int          tile_rows      = 0;
+  KCodec::Type codec          = KCodec::Zlib;
 
   QVector<KClass>      classes;
   KGeoRect             frame;
@@ -35,15 +52,32 @@ struct KPack
   KTile                main;
   QVector<KTile>       tiles;
 
-  void                 save(QString path) const;
   void                 loadMain(QString path, bool load_objects,
                                 double pixel_size_mm);
   void                 loadTile(QString path, int tile_idx);
+  bool readTile(int tile_idx, QVector<KObject>& objects) const;
+  QRectF               getTileRectM(int tile_idx) const;
   void                 loadAll(QString path, double pixel_size_mm);
   void                 clear();
   qint64               count();
   void                 addObject(KFreeObject free_obj);
   QVector<KFreeObject> getObjects();
+
+private:
+  static thread_local QByteArray block_buffer;
+
+  QFile        file;
+  const uchar* file_data = nullptr;
+  qint64       file_size = 0;
+  QByteArray   file_copy;
+
+  bool openFile(QString path);
+  void closeFile();
+  bool loadTileIndexV1();
+  bool isTileInFile(const KTile& tile) const;
+  bool readBlock(QByteArray& dst);
+  bool uncompressBlock(KCodec::Type codec, qint64 pos, int size,
+                       int raw_size, QByteArray& dst) const;
 };
 
 #endif  // KPACK_H
@@ -0,0 +1,524 @@
+#include "math.h"
+#include "kpackwriter.h"
+#include "kserialize.h"
+#include <QDebug>
+#include <QThreadPool>
+#include <QElapsedTimer>
+#include <algorithm>
+#include <zlib.h>
+
+namespace
+{
+bool containsRect(const QRectF& outer, const QRectF& inner)
+{
+  return inner.left() >= outer.left() &&
+         inner.right() <= outer.right() &&
+         inner.top() >= outer.top() &&
+         inner.bottom() <= outer.bottom();
+}
+
+QRectF getQuad(const QRectF& rect_m, int q)
+{
+  auto c = rect_m.center();
+  switch (q)
+  {
+  case 0:
+    return QRectF{rect_m.topLeft(), c};
+  case 1:
+    return QRectF{rect_m.topRight(), c}.normalized();
+  case 2:
+    return QRectF{rect_m.bottomLeft(), c}.normalized();
+  default:
+    return QRectF{c, rect_m.bottomRight()};
+  }
+}
+}
+
+quint64 KPackWriter::getNodeKey(int depth, int x, int y)
+{
+  return (quint64(depth) << 48) | (quint64(y) << 24) | quint64(x);
+}
+
+bool KPackWriter::open(QString _path, const KPack& header)
+{
+  path     = _path;
+  codec    = header.codec;
+  main_mip = header.main_mip;
+  tile_mip = header.tile_mip;
+  frame    = header.frame;
+  rect_m   = frame.toRectM().normalized();
+  classes  = header.classes;
+  borders  = header.borders;
+
+  spill_file.setFileTemplate(path + ".XXXXXX");
+  if (!spill_file.open())
+  {
+    qDebug() << "ERROR: unable to create spill file for" << path;
+    return false;
+  }
+  return true;
+}
+
+void KPackWriter::setTileLimits(TileLimits v)
+{
+  limits.max_object_count = std::max(1, v.max_object_count);
+  limits.max_size         = std::max<qint64>(1, v.max_size);
+  limits.max_depth        = std::clamp(v.max_depth, 0, 24);
+}
+
+void KPackWriter::setMemoryBudget(qint64 v)
+{
+  memory_budget = v;
+}
+
+qint64 KPackWriter::getObjectCount() const
+{
+  return object_count;
+}
+
+int KPackWriter::getTileCount() const
+{
+  return tile_count;
+}
+
+int KPackWriter::getSpillCount() const
+{
+  return spill_count;
+}
+
+qint64 KPackWriter::getCompressSize() const
+{
+  return compress_size;
+}
+
+qint64 KPackWriter::getCompressMs() const
+{
+  return compress_ns / 1000000;
+}
+
+KPackWriter::Node& KPackWriter::getNode(const QRectF& obj_rect_m)
+{
+  int    depth       = 0;
+  int    x           = 0;
+  int    y           = 0;
+  QRectF node_rect_m = rect_m;
+  if (containsRect(rect_m, obj_rect_m))
+    while (depth < limits.max_depth)
+    {
+      int q = 0;
+      while (q < 4 &&
+             !containsRect(getQuad(node_rect_m, q), obj_rect_m))
+        q++;
+      if (q == 4)
+        break;
+      node_rect_m = getQuad(node_rect_m, q);
+      x           = x * 2 + q % 2;
+      y           = y * 2 + q / 2;
+      depth++;
+    }
+
+  auto key = getNodeKey(depth, x, y);
+  auto it  = nodes.find(key);
+  if (it == nodes.end())
+  {
+    Node node;
+    node.depth = depth;
+    node.x     = x;
+    node.y     = y;
+    it         = nodes.insert(key, node);
+  }
+  return *it;
+}
+
+void KPackWriter::addObject(const KObject& obj)
+{
+  using namespace KSerialize;
+  if (is_failed)
+    return;
+
+  auto& ba = obj_buffer;
+  ba.clear();
+  obj.save(classes, ba);
+
+  auto& cl   = classes.at(obj.class_idx);
+  auto  node = &main;
+  if (cl.max_mip != 0 && cl.max_mip <= tile_mip)
+    node = &getNode(obj.frame.toRectM().normalized());
+
+  int size = ba.count();
+  if (node->chunk_count == 0 ||
+      node->chunk_obj_count >= limits.max_object_count ||
+      node->chunk_size + size > limits.max_size)
+  {
+    node->chunk_count++;
+    node->chunk_obj_count = 0;
+    node->chunk_size      = 0;
+  }
+  node->chunk_obj_count++;
+  node->chunk_size += size;
+  node->count++;
+  node->size += size;
+
+  auto old_buffer_size = node->buffer.count();
+  write(node->buffer, size);
+  write(node->buffer, obj.frame);
+  node->buffer.append(ba);
+  buffer_size += node->buffer.count() - old_buffer_size;
+  object_count++;
+
+  if (buffer_size > memory_budget)
+    if (!spill())
+      is_failed = true;
+}
+
+bool KPackWriter::spill()
+{
+  auto spillNode = [this](Node& node)
+  {
+    if (node.buffer.isEmpty())
+      return true;
+    Run run;
+    run.pos  = spill_file.pos();
+    run.size = node.buffer.count();
+    if (spill_file.write(node.buffer) != run.size)
+      return false;
+    node.runs.append(run);
+    node.buffer.clear();
+    return true;
+  };
+
+  spill_file.seek(spill_file.size());
+  bool ok = spillNode(main);
+  for (auto& node: nodes)
+    ok = ok && spillNode(node);
+  if (!ok)
+  {
+    qDebug() << "ERROR: unable to write spill file for" << path;
+    return false;
+  }
+  buffer_size = 0;
+  spill_count++;
+  return true;
+}
+
+bool KPackWriter::readRecords(const Node& node, RecordFn fn)
+{
+  using namespace KSerialize;
+  auto f = &spill_file;
+  for (auto& run: node.runs)
+  {
+    f->seek(run.pos);
+    while (f->pos() < run.pos + run.size)
+    {
+      int      size = 0;
+      KGeoRect obj_frame;
+      read(f, size);
+      read(f, obj_frame);
+      auto ba = f->read(size);
+      if (ba.count() != size)
+      {
+        qDebug() << "ERROR: unable to read spill file for" << path;
+        return false;
+      }
+      fn(obj_frame, ba);
+    }
+  }
+
+  int pos = 0;
+  while (pos < node.buffer.count())
+  {
+    int      size = 0;
+    KGeoRect obj_frame;
+    read(node.buffer, pos, size);
+    read(node.buffer, pos, obj_frame);
+    fn(obj_frame, node.buffer.mid(pos, size));
+    pos += size;
+  }
+  return true;
+}
+
+void KPackWriter::collectNodes(int depth, int x, int y,
+                               const QHash<quint64, Totals>& totals,
+                               QVector<quint64>& keys) const
+{
+  auto key = getNodeKey(depth, x, y);
+  if (totals.value(key).count == 0)
+    return;
+  if (nodes.contains(key))
+    keys.append(key);
+  if (depth >= limits.max_depth)
+    return;
+  for (int q = 0; q < 4; q++)
+    collectNodes(depth + 1, x * 2 + q % 2, y * 2 + q / 2, totals,
+                 keys);
+}
+
+void KPackWriter::planTiles(int depth, int x, int y,
+                            const QHash<quint64, Totals>& totals,
+                            QVector<QVector<quint64>>& groups) const
+{
+  auto key  = getNodeKey(depth, x, y);
+  auto node = totals.value(key);
+  if (node.count == 0)
+    return;
+  if (depth >= limits.max_depth ||
+      (node.count <= limits.max_object_count &&
+       node.size <= limits.max_size))
+  {
+    QVector<quint64> keys;
+    collectNodes(depth, x, y, totals, keys);
+    groups.append(keys);
+    return;
+  }
+
+  if (nodes.contains(key))
+    groups.append(QVector<quint64>{key});
+  for (int q = 0; q < 4; q++)
+    planTiles(depth + 1, x * 2 + q % 2, y * 2 + q / 2, totals,
+              groups);
+}
+
+void KPackWriter::writeBlock(QFile* f, const QByteArray& ba) const
+{
+  using namespace KSerialize;
+  auto compressed_ba = KCodec::compress(codec, ba);
+  write(f, codec);
+  write(f, ba.count());
+  write(f, compressed_ba.count());
+  f->write(compressed_ba.data(), compressed_ba.count());
+}
+
+bool KPackWriter::writeMainBlock(QFile* f)
+{
+  using namespace KSerialize;
+  if (codec != KCodec::Zlib)
+  {
+    if (main.size > memory_budget)
+      qDebug() << "WARNING: main block of" << main.size
+               << "bytes exceeds the memory budget in" << path;
+    QByteArray main_ba;
+    if (!readRecords(main,
+                     [&main_ba](const KGeoRect&, const QByteArray& ba)
+                     {
+                       main_ba.append(ba);
+                     }))
+      return false;
+    writeBlock(f, main_ba);
+    return true;
+  }
+
+  // stream the same bytes qCompress() would produce: a big-endian
+  // raw size followed by one zlib stream
+  int raw_size = main.size;
+  write(f, codec);
+  write(f, raw_size);
+  auto size_pos = f->pos();
+  write(f, 0);
+  auto  start_pos  = f->pos();
+  uchar size_be[4] = {uchar(raw_size >> 24), uchar(raw_size >> 16),
+                      uchar(raw_size >> 8), uchar(raw_size)};
+  f->write((const char*)size_be, sizeof(size_be));
+
+  z_stream zs = {};
+  if (deflateInit(&zs, 9) != Z_OK)
+    return false;
+  QByteArray out(1 << 16, 0);
+  auto       deflateTo = [&](const QByteArray& ba, int flush)
+  {
+    zs.next_in  = (Bytef*)ba.constData();
+    zs.avail_in = ba.count();
+    do
+    {
+      zs.next_out  = (Bytef*)out.data();
+      zs.avail_out = out.count();
+      deflate(&zs, flush);
+      f->write(out.constData(), out.count() - zs.avail_out);
+    } while (zs.avail_out == 0);
+  };
+  bool ok = readRecords(main,
+                        [&](const KGeoRect&, const QByteArray& ba)
+                        {
+                          deflateTo(ba, Z_NO_FLUSH);
+                        });
+  deflateTo(QByteArray(), Z_FINISH);
+  deflateEnd(&zs);
+  if (!ok)
+    return false;
+
+  auto end_pos = f->pos();
+  f->seek(size_pos);
+  write(f, int(end_pos - start_pos));
+  f->seek(end_pos);
+  return true;
+}
+
+bool KPackWriter::finish()
+{
+  if (!is_failed && writePack())
+    return true;
+  QFile::remove(path);
+  return false;
+}
+
+bool KPackWriter::writePack()
+{
+  using namespace KSerialize;
+  QHash<quint64, Totals> totals;
+  for (auto& node: nodes)
+    for (int d = node.depth, x = node.x, y = node.y; d >= 0;
+         d--, x /= 2, y /= 2)
+    {
+      auto& t = totals[getNodeKey(d, x, y)];
+      t.count += node.count;
+      t.size += node.size;
+    }
+
+  QVector<QVector<quint64>> groups;
+  planTiles(0, 0, 0, totals, groups);
+  tile_count = 0;
+  for (auto& group: groups)
+    if (group.count() == 1)
+      tile_count += nodes[group.first()].chunk_count;
+    else
+      tile_count++;
+
+  QFile f(path);
+  if (!f.open(QIODevice::WriteOnly))
+  {
+    qDebug() << "write error:" << path;
+    return false;
+  }
+
+  write(&f, QString("kpack%1").arg(KPack::current_format_version));
+  write(&f, frame);
+  write(&f, main_mip);
+  write(&f, tile_mip);
+  write(&f, 0);
+  write(&f, 0);
+  write(&f, tile_count);
+  auto tile_table_pos = f.pos();
+  f.write(QByteArray(tile_count * KPack::tile_entry_size, 0));
+
+  char has_borders = (borders.count() > 0);
+  write(&f, has_borders);
+
+  if (has_borders)
+  {
+    QByteArray ba;
+    write(ba, borders.count());
+    for (auto border: borders)
+      border.save(ba, KPack::border_coor_precision_coef);
+    writeBlock(&f, ba);
+  }
+
+  write(&f, classes.count());
+  for (auto cl: classes)
+    cl.save(&f);
+
+  write(&f, main.count);
+  QElapsedTimer t;
+  t.start();
+  if (!writeMainBlock(&f))
+    return false;
+  compress_size += main.size;
+  compress_ns += t.nsecsElapsed();
+
+  QThreadPool pool;
+  int         batch_size = std::clamp<qint64>(
+      memory_budget / limits.max_size, 1, pool.maxThreadCount() * 4);
+
+  QVector<KTile>      entries;
+  QVector<QByteArray> blocks;
+  QByteArray          tile_table;
+  int                 written_count = 0;
+
+  auto flushBatch = [&]()
+  {
+    t.start();
+    for (int i = 0; i < blocks.count(); i++)
+      pool.start(
+          [this, i, &entries, &blocks]()
+          {
+            auto& entry    = entries[i];
+            entry.raw_size = blocks[i].count();
+            blocks[i]      = KCodec::compress(codec, blocks[i]);
+            entry.size     = blocks[i].count();
+          });
+    pool.waitForDone();
+    compress_ns += t.nsecsElapsed();
+    for (auto& entry: entries)
+      compress_size += entry.raw_size;
+
+    for (int i = 0; i < blocks.count(); i++)
+    {
+      auto& entry = entries[i];
+      entry.pos   = f.pos();
+      f.write(blocks[i]);
+      write(tile_table, entry.pos);
+      write(tile_table, entry.size);
+      write(tile_table, entry.raw_size);
+      write(tile_table, entry.frame);
+      write(tile_table, entry.object_count);
+      write(tile_table, entry.codec);
+    }
+    written_count += blocks.count();
+    entries.clear();
+    blocks.clear();
+  };
+
+  auto appendRecord = [&](const KGeoRect& rect, const QByteArray& ba)
+  {
+    if (entries.isEmpty() ||
+        (entries.last().object_count > 0 &&
+         (entries.last().object_count >= limits.max_object_count ||
+          blocks.last().count() + ba.count() > limits.max_size)))
+    {
+      if (entries.count() >= batch_size)
+        flushBatch();
+      KTile entry;
+      entry.codec = codec;
+      entries.append(entry);
+      blocks.append(QByteArray());
+    }
+    auto& entry = entries.last();
+    if (entry.object_count == 0)
+      entry.frame = rect;
+    else
+      entry.frame = entry.frame.united(rect);
+    entry.object_count++;
+    blocks.last().append(ba);
+  };
+
+  for (auto& group: groups)
+  {
+    if (!entries.isEmpty() && entries.last().object_count > 0)
+    {
+      if (entries.count() >= batch_size)
+        flushBatch();
+      KTile entry;
+      entry.codec = codec;
+      entries.append(entry);
+      blocks.append(QByteArray());
+    }
+    for (auto key: group)
+      if (!readRecords(nodes[key], appendRecord))
+        return false;
+  }
+  flushBatch();
+
+  if (written_count != tile_count)
+  {
+    qDebug() << "ERROR: planned" << tile_count << "tiles, written"
+             << written_count << "in" << path;
+    return false;
+  }
+  f.seek(tile_table_pos);
+  f.write(tile_table);
+  spill_file.close();
+  if (f.error() != QFileDevice::NoError)
+  {
+    qDebug() << "write error:" << path;
+    return false;
+  }
+  return true;
+}
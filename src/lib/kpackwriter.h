@@ -0,0 +1,99 @@
+#ifndef KPACKWRITER_H
+#define KPACKWRITER_H
+
+#include <QTemporaryFile>
+#include <QHash>
+#include <functional>
+#include "kpack.h"
+
+class KPackWriter
+{
+public:
+  struct TileLimits
+  {
+    int    max_object_count = 50000;
+    qint64 max_size         = 4 << 20;
+    int    max_depth        = 8;
+  };
+
+private:
+  struct Run
+  {
+    qint64 pos  = 0;
+    qint64 size = 0;
+  };
+
+  struct Node
+  {
+    int          depth           = 0;
+    int          x               = 0;
+    int          y               = 0;
+    int          count           = 0;
+    qint64       size            = 0;
+    int          chunk_count     = 0;
+    int          chunk_obj_count = 0;
+    qint64       chunk_size      = 0;
+    QVector<Run> runs;
+    QByteArray   buffer;
+  };
+
+  struct Totals
+  {
+    qint64 count = 0;
+    qint64 size  = 0;
+  };
+
+  QString              path;
+  KCodec::Type         codec    = KCodec::Zlib;
+  double               main_mip = 0;
+  double               tile_mip = 0;
+  KGeoRect             frame;
+  QRectF               rect_m;
+  QVector<KClass>      classes;
+  QVector<KGeoPolygon> borders;
+  TileLimits           limits;
+  qint64               memory_budget = 256 << 20;
+  qint64               buffer_size   = 0;
+  qint64               object_count  = 0;
+  int                  spill_count   = 0;
+  int                  tile_count    = 0;
+  qint64               compress_size = 0;
+  qint64               compress_ns   = 0;
+  bool                 is_failed     = false;
+  Node                 main;
+  QHash<quint64, Node> nodes;
+  QByteArray           obj_buffer;
+  QTemporaryFile       spill_file;
+
+  typedef std::function<void(const KGeoRect&, const QByteArray&)>
+      RecordFn;
+
+  static quint64 getNodeKey(int depth, int x, int y);
+
+  Node& getNode(const QRectF& obj_rect_m);
+  bool  spill();
+  bool  readRecords(const Node& node, RecordFn fn);
+  void  planTiles(int depth, int x, int y,
+                  const QHash<quint64, Totals>& totals,
+                  QVector<QVector<quint64>>&    groups) const;
+  void  collectNodes(int depth, int x, int y,
+                     const QHash<quint64, Totals>& totals,
+                     QVector<quint64>&             keys) const;
+  void  writeBlock(QFile* f, const QByteArray& ba) const;
+  bool  writeMainBlock(QFile* f);
+  bool  writePack();
+
+public:
+  bool   open(QString path, const KPack& header);
+  void   setTileLimits(TileLimits);
+  void   setMemoryBudget(qint64);
+  void   addObject(const KObject& obj);
+  bool   finish();
+  qint64 getObjectCount() const;
+  int    getTileCount() const;
+  int    getSpillCount() const;
+  qint64 getCompressSize() const;
+  qint64 getCompressMs() const;
+};
+
+#endif  // KPACKWRITER_H
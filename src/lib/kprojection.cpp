@@ -0,0 +1,326 @@
+#include "math.h"
+#include "kprojection.h"
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+static_assert(sizeof(KGeoCoor) == 2 * sizeof(int),
+              "KGeoCoor must be a packed lat/lon int pair");
+
+namespace
+{
+constexpr double lon_coef  = 1E-7 * M_PI / 180 * kmath::earth_r;
+constexpr double lat_coef  = 1E-7 * M_PI / 180;
+constexpr double sqrt2     = 1.4142135623730951;
+constexpr double ln2       = 0.6931471805599453;
+constexpr double two_pow52 = 4503599627370496.0;
+
+constexpr quint64 exp_magic = 0x4330000000000000ULL;
+constexpr quint64 mant_mask = 0x000fffffffffffffULL;
+constexpr quint64 one_bits  = 0x3ff0000000000000ULL;
+
+struct ScalarKernel
+{
+  typedef double type;
+
+  static constexpr int         size = 1;
+  static constexpr const char* name = "scalar";
+
+  static type set(double v)
+  {
+    return v;
+  }
+  static type add(type a, type b)
+  {
+    return a + b;
+  }
+  static type sub(type a, type b)
+  {
+    return a - b;
+  }
+  static type mul(type a, type b)
+  {
+    return a * b;
+  }
+  static type div(type a, type b)
+  {
+    return a / b;
+  }
+  static void load(const int* src, type& lat, type& lon)
+  {
+    lat = src[0];
+    lon = src[1];
+  }
+  static void store(double* dst, type v)
+  {
+    *dst = v;
+  }
+  static void split(type v, type& e, type& m)
+  {
+    quint64 bits;
+    memcpy(&bits, &v, sizeof(bits));
+    e            = double(bits >> 52) - 1023;
+    quint64 mant = (bits & mant_mask) | one_bits;
+    memcpy(&m, &mant, sizeof(m));
+    if (m > sqrt2)
+    {
+      m *= 0.5;
+      e += 1;
+    }
+  }
+};
+
+#if defined(__AVX2__)
+struct VectorKernel
+{
+  typedef __m256d type;
+
+  static constexpr int         size = 4;
+  static constexpr const char* name = "avx2";
+
+  static type set(double v)
+  {
+    return _mm256_set1_pd(v);
+  }
+  static type add(type a, type b)
+  {
+    return _mm256_add_pd(a, b);
+  }
+  static type sub(type a, type b)
+  {
+    return _mm256_sub_pd(a, b);
+  }
+  static type mul(type a, type b)
+  {
+    return _mm256_mul_pd(a, b);
+  }
+  static type div(type a, type b)
+  {
+    return _mm256_div_pd(a, b);
+  }
+  static void load(const int* src, type& lat, type& lon)
+  {
+    auto v = _mm256_loadu_si256((const __m256i*)src);
+    v      = _mm256_permutevar8x32_epi32(
+        v, _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7));
+    lat = _mm256_cvtepi32_pd(_mm256_castsi256_si128(v));
+    lon = _mm256_cvtepi32_pd(_mm256_extracti128_si256(v, 1));
+  }
+  static void store(double* dst, type v)
+  {
+    _mm256_storeu_pd(dst, v);
+  }
+  static void split(type v, type& e, type& m)
+  {
+    auto bits = _mm256_castpd_si256(v);
+    auto eb   = _mm256_or_si256(_mm256_srli_epi64(bits, 52),
+                                _mm256_set1_epi64x(exp_magic));
+    e = _mm256_sub_pd(_mm256_castsi256_pd(eb), set(two_pow52 + 1023));
+    m = _mm256_castsi256_pd(_mm256_or_si256(
+        _mm256_and_si256(bits, _mm256_set1_epi64x(mant_mask)),
+        _mm256_set1_epi64x(one_bits)));
+    auto gt = _mm256_cmp_pd(m, set(sqrt2), _CMP_GT_OQ);
+    m       = _mm256_sub_pd(m, _mm256_and_pd(gt, mul(m, set(0.5))));
+    e       = _mm256_add_pd(e, _mm256_and_pd(gt, set(1)));
+  }
+};
+#elif defined(__SSE2__)
+struct VectorKernel
+{
+  typedef __m128d type;
+
+  static constexpr int         size = 2;
+  static constexpr const char* name = "sse2";
+
+  static type set(double v)
+  {
+    return _mm_set1_pd(v);
+  }
+  static type add(type a, type b)
+  {
+    return _mm_add_pd(a, b);
+  }
+  static type sub(type a, type b)
+  {
+    return _mm_sub_pd(a, b);
+  }
+  static type mul(type a, type b)
+  {
+    return _mm_mul_pd(a, b);
+  }
+  static type div(type a, type b)
+  {
+    return _mm_div_pd(a, b);
+  }
+  static void load(const int* src, type& lat, type& lon)
+  {
+    auto v = _mm_loadu_si128((const __m128i*)src);
+    v      = _mm_shuffle_epi32(v, _MM_SHUFFLE(3, 1, 2, 0));
+    lat    = _mm_cvtepi32_pd(v);
+    lon    = _mm_cvtepi32_pd(_mm_unpackhi_epi64(v, v));
+  }
+  static void store(double* dst, type v)
+  {
+    _mm_storeu_pd(dst, v);
+  }
+  static void split(type v, type& e, type& m)
+  {
+    auto bits = _mm_castpd_si128(v);
+    auto eb   = _mm_or_si128(_mm_srli_epi64(bits, 52),
+                             _mm_set1_epi64x(exp_magic));
+    e = _mm_sub_pd(_mm_castsi128_pd(eb), set(two_pow52 + 1023));
+    m = _mm_castsi128_pd(
+        _mm_or_si128(_mm_and_si128(bits, _mm_set1_epi64x(mant_mask)),
+                     _mm_set1_epi64x(one_bits)));
+    auto gt = _mm_cmpgt_pd(m, set(sqrt2));
+    m       = _mm_sub_pd(m, _mm_and_pd(gt, mul(m, set(0.5))));
+    e       = _mm_add_pd(e, _mm_and_pd(gt, set(1)));
+  }
+};
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+struct VectorKernel
+{
+  typedef float64x2_t type;
+
+  static constexpr int         size = 2;
+  static constexpr const char* name = "neon";
+
+  static type set(double v)
+  {
+    return vdupq_n_f64(v);
+  }
+  static type add(type a, type b)
+  {
+    return vaddq_f64(a, b);
+  }
+  static type sub(type a, type b)
+  {
+    return vsubq_f64(a, b);
+  }
+  static type mul(type a, type b)
+  {
+    return vmulq_f64(a, b);
+  }
+  static type div(type a, type b)
+  {
+    return vdivq_f64(a, b);
+  }
+  static void load(const int* src, type& lat, type& lon)
+  {
+    auto v = vld2_s32(src);
+    lat    = vcvtq_f64_s64(vmovl_s32(v.val[0]));
+    lon    = vcvtq_f64_s64(vmovl_s32(v.val[1]));
+  }
+  static void store(double* dst, type v)
+  {
+    vst1q_f64(dst, v);
+  }
+  static void split(type v, type& e, type& m)
+  {
+    auto bits = vreinterpretq_u64_f64(v);
+    auto eb   = vorrq_u64(vshrq_n_u64(bits, 52),
+                          vdupq_n_u64(exp_magic));
+    e = vsubq_f64(vreinterpretq_f64_u64(eb), set(two_pow52 + 1023));
+    m = vreinterpretq_f64_u64(
+        vorrq_u64(vandq_u64(bits, vdupq_n_u64(mant_mask)),
+                  vdupq_n_u64(one_bits)));
+    auto gt = vcgtq_f64(m, set(sqrt2));
+    m       = vbslq_f64(gt, mul(m, set(0.5)), m);
+    e       = vbslq_f64(gt, add(e, set(1)), e);
+  }
+};
+#else
+typedef ScalarKernel VectorKernel;
+#endif
+
+template<class K>
+typename K::type mercatorY(typename K::type phi)
+{
+  // y = R * atanh(sin(phi)), with sin and log expanded as
+  // polynomials so that every lane runs the same instructions
+  auto x2 = K::mul(phi, phi);
+  auto s  = K::set(1.0 / 355687428096000);
+  s       = K::add(K::mul(s, x2), K::set(-1.0 / 1307674368000));
+  s       = K::add(K::mul(s, x2), K::set(1.0 / 6227020800));
+  s       = K::add(K::mul(s, x2), K::set(-1.0 / 39916800));
+  s       = K::add(K::mul(s, x2), K::set(1.0 / 362880));
+  s       = K::add(K::mul(s, x2), K::set(-1.0 / 5040));
+  s       = K::add(K::mul(s, x2), K::set(1.0 / 120));
+  s       = K::add(K::mul(s, x2), K::set(-1.0 / 6));
+  s       = K::add(K::mul(s, x2), K::set(1));
+  s       = K::mul(s, phi);
+
+  auto one = K::set(1);
+  auto r   = K::div(K::add(one, s), K::sub(one, s));
+
+  typename K::type e, m;
+  K::split(r, e, m);
+  auto t  = K::div(K::sub(m, one), K::add(m, one));
+  auto t2 = K::mul(t, t);
+  auto l  = K::set(1.0 / 19);
+  for (int k = 17; k >= 1; k -= 2)
+    l = K::add(K::mul(l, t2), K::set(1.0 / k));
+  l = K::mul(K::mul(l, t), K::set(2));
+  l = K::add(l, K::mul(e, K::set(ln2)));
+  return K::mul(l, K::set(0.5 * kmath::earth_r));
+}
+
+template<class K>
+int toMeters(const int* src, int count, double* x, double* y)
+{
+  int i = 0;
+  for (; i + K::size <= count; i += K::size)
+  {
+    typename K::type lat, lon;
+    K::load(src + 2 * i, lat, lon);
+    K::store(x + i, K::mul(lon, K::set(lon_coef)));
+    K::store(y + i, mercatorY<K>(K::mul(lat, K::set(lat_coef))));
+  }
+  return i;
+}
+
+void toMeters(const KGeoCoor* src, int count, double* x, double* y)
+{
+  auto ints = reinterpret_cast<const int*>(src);
+  int  done = toMeters<VectorKernel>(ints, count, x, y);
+  toMeters<ScalarKernel>(ints + 2 * done, count - done, x + done,
+                         y + done);
+}
+}
+
+namespace kmath
+{
+const char* getProjectionKernelName()
+{
+  return VectorKernel::name;
+}
+
+void deg2meters(const KGeoCoor* src, int count, QPointF* dst)
+{
+  constexpr int chunk_size = 256;
+  double        x[chunk_size];
+  double        y[chunk_size];
+  for (int start = 0; start < count; start += chunk_size)
+  {
+    int n = std::min(chunk_size, count - start);
+    toMeters(src + start, n, x, y);
+    for (int i = 0; i < n; i++)
+      dst[start + i] = {x[i], y[i]};
+  }
+}
+
+void meters2pix(const float* src, int count, QPointF* dst,
+                QPointF src_origin_m, QPoint origin_pix, double mip)
+{
+  double scale = 1.0 / mip;
+  auto   base  = src_origin_m * scale - QPointF(origin_pix);
+  for (int i = 0; i < count; i++)
+    dst[i] = base + QPointF(src[2 * i], src[2 * i + 1]) * scale;
+}
+}
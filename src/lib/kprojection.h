@@ -0,0 +1,14 @@
+#ifndef KPROJECTION_H
+#define KPROJECTION_H
+
+#include "kbase.h"
+
+namespace kmath
+{
+const char* getProjectionKernelName();
+void deg2meters(const KGeoCoor* src, int count, QPointF* dst);
+void meters2pix(const float* src, int count, QPointF* dst,
+                QPointF src_origin_m, QPoint origin_pix, double mip);
+}
+
+#endif  // KPROJECTION_H
@@ -1,13 +1,20 @@
 ﻿#include "math.h"
 #include "krender.h"
-#include "klocker.h"
+#include "kprojection.h"
+#include "kserialize.h"
+#include "kclip.h"
 #include <QDir>
-#include <QtConcurrent/QtConcurrent>
+#include <QDateTime>
 #include <QPainterPath>
 #include <numeric>
 
 using namespace kmath;
 
+thread_local QVector<QPointF>          KRender::pix_buffer;
+thread_local QVector<QPointF>          KRender::clip_buffer;
+thread_local QVector<QVector<QPointF>> KRender::clip_pieces;
+thread_local QPoint                    KRender::tile_origin_pix;
+
 QPoint KRender::deg2scr(const KGeoCoor& deg) const
 {
   return meters2pix(deg.toMeters());
@@ -33,10 +40,19 @@ QPointF KRender::pix2meters(QPointF pix) const
   return {xm, ym};
 }
 
+KRender::KRender()
+{
+  connect(&loader, &KTileLoader::loaded, this, &KRender::onLoaded);
+  connect(this, &QThread::finished, this, &KRender::onFinished);
+  render_pool.setMaxThreadCount(
+      std::max(1, QThread::idealThreadCount() - 1));
+  tile_cache.setTileSize({tile_size_pix, tile_size_pix});
+}
+
 KRender::~KRender()
 {
-  QThreadPool().globalInstance()->waitForDone();
   stopAndWait();
+  render_pool.waitForDone();
 }
 
 void KRender::addPack(QString path, bool load_now)
@@ -48,8 +64,11 @@ void KRender::addPack(QString path, bool load_now)
 void KRender::insertPack(int idx, QString path, bool load_now)
 {
   auto map = new KRenderPack(path);
-  map->loadMain(load_now, pixel_size_mm);
+  map->loadMain(false, pixel_size_mm);
+  if (load_now)
+    map->loadMain(true, pixel_size_mm);
   packs.insert(idx, map);
+  data_generation.ref();
 }
 
 void KRender::setMip(double v)
@@ -79,12 +98,16 @@ QPointF KRender::getRenderCenterM() const
 
 void KRender::setPixmapSize(QSize v)
 {
-  pixmap_size = v * render_window_size_coef;
+  auto new_size = v * render_window_size_coef;
+  if (new_size != pixmap_size)
+    data_generation.ref();
+  pixmap_size = new_size;
 }
 
 void KRender::setPixelSizeMM(double v)
 {
   pixel_size_mm = v;
+  data_generation.ref();
 }
 
 void KRender::setUpdateIntervalMs(int v)
@@ -95,6 +118,7 @@ void KRender::setUpdateIntervalMs(int v)
 void KRender::setBackgroundColor(QColor v)
 {
   ocean_color = v;
+  data_generation.ref();
 }
 
 double KRender::getRenderWindowSizeCoef() const
@@ -112,12 +136,32 @@ void KRender::setMaxLoadedMapsCount(int v)
   max_loaded_maps_count = v;
 }
 
+void KRender::setMapMemorySize(qint64 v)
+{
+  memory_manager.setMaxSize(v);
+}
+
+KMemoryManager::Usage KRender::getMapMemoryUsage() const
+{
+  return memory_manager.getUsage();
+}
+
+void KRender::setTileCacheSize(qint64 v)
+{
+  tile_cache.setMaxSize(v);
+}
+
+void KRender::setTileCacheDir(QString path, qint64 max_size)
+{
+  tile_cache.setSpillDir(path, max_size);
+}
+
 const QPixmap* KRender::getPixmap() const
 {
   return getting_pixmap_enabled ? &render_pixmap : nullptr;
 }
 
-const KPack* KRender::getWorldPack() const
+const KRenderPack* KRender::getWorldPack() const
 {
   return packs.first();
 }
@@ -141,14 +185,18 @@ void KRender::checkUnload()
     i++;
     if (i == 0)
       continue;
-    if (pack->main.status == KTile::Loaded)
+    if (pack->getSnapshot())
     {
       if (!needToLoadPack(pack, draw_rect_m))
         if (loaded_count > max_loaded_maps_count)
+        {
           pack->clear();
+          data_generation.ref();
+        }
       loaded_count++;
     }
   }
+  memory_manager.collect(packs, render_stamp);
 }
 
 bool KRender::needToLoadPack(const KRenderPack* pack,
@@ -177,67 +225,79 @@ bool KRender::needToLoadPack(const KRenderPack* pack,
   return false;
 }
 
+void KRender::requestTiles(KRenderPack* pack, const QRectF& rect_m,
+                           double req_mip, bool is_prefetch)
+{
+  auto s = pack->getSnapshot();
+  if (!s)
+  {
+    loader.request({pack, KTileLoader::main_tile_idx, pixel_size_mm,
+                    is_prefetch});
+    return;
+  }
+  if (req_mip >= pack->tile_mip)
+    return;
+  QVector<int> tile_idx_list;
+  s->tile_rtree->search(rect_m, tile_idx_list);
+  std::sort(tile_idx_list.begin(), tile_idx_list.end());
+  for (auto tile_idx: tile_idx_list)
+  {
+    if (s->tile_stores[tile_idx] ||
+        s->pack->tiles[tile_idx].object_count == 0)
+      continue;
+    loader.request({pack, tile_idx, pixel_size_mm, is_prefetch});
+  }
+}
+
 void KRender::checkLoad()
 {
   auto draw_rect_m = getDrawRectM();
   for (auto& pack: packs)
+    if (needToLoadPack(pack, draw_rect_m))
+      requestTiles(pack, draw_rect_m, render_mip, false);
+}
+
+void KRender::prefetch(QPointF shift_pix, double zoom_coef)
+{
+  loader.cancelPrefetch();
+  if (!loading_enabled)
+    return;
+
+  auto   rect_m   = getDrawRectM();
+  double next_mip = mip * zoom_coef;
+  rect_m.translate(shift_pix * mip);
+  if (zoom_coef != 1)
   {
-    auto map_rect_m = pack->frame.toMeters();
+    auto center_m = rect_m.center();
+    rect_m.setSize(rect_m.size() * zoom_coef);
+    rect_m.moveCenter(center_m);
+  }
 
-    if (!needToLoadPack(pack, draw_rect_m))
+  for (auto& pack: packs)
+  {
+    if (pack->main_mip > 0 && next_mip > pack->main_mip)
       continue;
-
-    if (pack->main.status == KTile::Null)
-      pack->loadMain(true, pixel_size_mm);
-    if (pack->main.status == KTile::Loaded)
-    {
-      if (needToLoadPack(pack, draw_rect_m))
-      {
-        int    tile_side_count = sqrt(pack->tiles.count());
-        QSizeF tile_size_m = {map_rect_m.width() / tile_side_count,
-                              map_rect_m.height() / tile_side_count};
-        for (int tile_idx = 0; auto& tile: pack->tiles)
-        {
-          int    tile_idx_y = tile_idx / tile_side_count;
-          int    tile_idx_x = tile_idx - tile_idx_y * tile_side_count;
-          double tile_left =
-              map_rect_m.x() + tile_idx_x * tile_size_m.width();
-          double tile_top =
-              map_rect_m.y() + tile_idx_y * tile_size_m.height();
-          QRectF tile_rect_m = {{tile_left, tile_top}, tile_size_m};
-          if (tile.status == KTile::Null &&
-              tile_rect_m.intersects(draw_rect_m) &&
-              render_mip < pack->tile_mip)
-            pack->loadTile(tile_idx);
-          tile_idx++;
-        }
-      }
-    }
+    if (rect_m.intersects(pack->frame.toMeters()))
+      requestTiles(pack, rect_m, next_mip, true);
   }
 }
 
-void KRender::paintPointName(QPainter* p, const QString& text,
-                             const QColor& tcolor)
+void KRender::cancelPrefetch()
 {
-  QRect rect;
-  int   w = 20.0 / pixel_size_mm;
-  rect.setSize({w, w});
+  loader.cancelPrefetch();
+}
 
-  p->setPen(Qt::white);
-  auto shifts = {-2, 0, 2};
-  int  flags  = Qt::AlignLeft | Qt::AlignTop | Qt::TextWordWrap |
-              Qt::TextDontClip;
-  for (auto x: shifts)
-    for (auto y: shifts)
-    {
-      p->save();
-      p->translate(x, y);
-      p->drawText(rect, flags, text);
-      p->restore();
-    }
+QSize KRender::getPointNameSize() const
+{
+  int w = 20.0 / pixel_size_mm;
+  return {w, w};
+}
 
-  p->setPen(tcolor);
-  p->drawText(rect, flags, text);
+void KRender::paintPointName(QPainter* p, const QString& text,
+                             const QColor& tcolor)
+{
+  paintOutlinedText(p, {{0, 0}, getPointNameSize()}, point_name_flags,
+                    text, tcolor);
 }
 
 void KRender::paintOutlinedText(QPainter* p, const QString& text,
@@ -253,103 +313,159 @@ void KRender::paintOutlinedText(QPainter* p, const QString& text,
   p->drawText(0, 0, text);
 }
 
-void KRender::paintOutlinedText(QPainter* p, const DrawTextEntry& dte)
+void KRender::paintOutlinedText(QPainter* p, QRect rect, int flags,
+                                const QString& text,
+                                const QColor&  tcolor)
 {
   p->setPen(Qt::white);
   auto shifts = {-2, 0, 2};
-
   for (auto x: shifts)
     for (auto y: shifts)
-    {
-      p->save();
-      p->translate(x, y);
-      p->drawText(dte.rect,
-                  dte.alignment | Qt::TextWordWrap | Qt::TextDontClip,
-                  dte.text);
-      p->restore();
-    }
+      p->drawText(rect.translated(x, y), flags, text);
 
-  p->setPen(dte.cl->tcolor);
-  p->drawText(dte.rect,
-              dte.alignment | Qt::TextWordWrap | Qt::TextDontClip,
-              dte.text);
+  p->setPen(tcolor);
+  p->drawText(rect, flags, text);
 }
 
-void KRender::addDrawTextEntry(
-    QVector<DrawTextEntry>& draw_text_array, DrawTextEntry new_dte)
+KLabelCache::Sprite KRender::getLabelSprite(const QFont&   font,
+                                            const QString& text,
+                                            const QColor&  tcolor,
+                                            double         angle_deg,
+                                            QSize          wrap_size,
+                                            int            flags)
 {
-  bool can_fit = true;
-  for (auto dte: draw_text_array)
+  KLabelCache::Key key = {text, font.pixelSize(), tcolor.rgba(),
+                          int(round(angle_deg)), wrap_size, flags};
+  KLabelCache::Sprite sprite;
+  if (text.isEmpty() || label_cache.find(key, sprite))
+    return sprite;
+
+  QFontMetrics fm(font);
+  QRect        text_rect;
+  if (wrap_size.isEmpty())
+    text_rect = fm.boundingRect(text);
+  else
+    text_rect = fm.boundingRect({{0, 0}, wrap_size}, flags, text);
+  int  margin = label_halo_pix + 1;
+  auto image_rect =
+      text_rect.adjusted(-margin, -margin, margin, margin);
+
+  sprite.image =
+      QImage(image_rect.size(), QImage::Format_ARGB32_Premultiplied);
+  sprite.image.fill(Qt::transparent);
+  QPainter p(&sprite.image);
+  p.setRenderHint(QPainter::TextAntialiasing);
+  p.setFont(font);
+  p.translate(-image_rect.topLeft());
+  if (wrap_size.isEmpty())
+    paintOutlinedText(&p, text, tcolor);
+  else
+    paintOutlinedText(&p, {{0, 0}, wrap_size}, flags, text, tcolor);
+  p.end();
+
+  sprite.origin = -image_rect.topLeft();
+  if (key.angle_deg != 0)
   {
-    if (dte.actual_rect.intersects(new_dte.actual_rect))
-    {
-      can_fit = false;
-      break;
-    }
+    QTransform tr;
+    tr.rotate(key.angle_deg);
+    auto w        = sprite.image.width();
+    auto h        = sprite.image.height();
+    sprite.origin = QImage::trueMatrix(tr, w, h).map(sprite.origin);
+    sprite.image =
+        sprite.image.transformed(tr, Qt::SmoothTransformation);
   }
-  if (can_fit)
-    draw_text_array.append(new_dte);
-};
+  label_cache.insert(key, sprite);
+  return sprite;
+}
 
 QPoint KRender::deg2pix(KGeoCoor kp) const
 {
-  auto m = kp.toMeters();
+  return meters2renderPix(kp.toMeters());
+}
+
+QPoint KRender::meters2tilePix(QPointF m) const
+{
+  return QPoint{int(floor(m.x() / render_mip)),
+                int(floor(m.y() / render_mip))} -
+         tile_origin_pix;
+}
+
+bool KRender::isInTile(QPoint pix) const
+{
+  return pix.x() >= 0 && pix.y() >= 0 && pix.x() < tile_size_pix &&
+         pix.y() < tile_size_pix;
+}
+
+QPoint KRender::meters2renderPix(QPointF m) const
+{
   return {int((m.x() - render_top_left_m.x()) / render_mip),
           int((m.y() - render_top_left_m.y()) / render_mip)};
 }
 
 void KRender::paintPointObject(QPainter* p, const KRenderPack& pack,
-                               const KObject& obj, int render_idx)
+                               const KTileStore&         store,
+                               const KTileStore::Object& obj,
+                               int                       bin_idx)
 {
-  auto frame = obj.frame;
-
-  auto coor_m = frame.top_left.toMeters();
-
-  if (!render_frame_m.contains(coor_m))
+  auto   coor_m = obj.frame_m.topLeft();
+  QPoint pos    = meters2tilePix(coor_m);
+  if (!isInTile(pos))
     return;
 
-  auto cl = &pack.classes[obj.class_idx];
+  auto cl = &pack.getClasses()[obj.class_idx];
   p->setPen(QPen(cl->pen, 2));
   p->setBrush(cl->brush);
-  auto        kpos       = obj.polygons.first().first();
-  QPoint      pos        = deg2pix(kpos);
   int         max_length = 0;
   QStringList str_list;
-  if (!obj.name.isEmpty())
+  auto        name       = store.getName(obj);
+  if (!name.isEmpty())
   {
-    str_list += obj.name;
-    max_length = obj.name.count();
+    str_list += name;
+    max_length = name.count();
   }
 
   auto rect = QRect{pos.x(), pos.y(), max_length * cl->getWidthPix(),
                     str_list.count() * cl->getWidthPix()};
+  bins[bin_idx].labels.point_names.append(
+      {rect, str_list, cl, obj.class_idx});
+}
 
-  bool intersects = false;
-  for (auto item: point_names[render_idx])
-  {
-    if (rect.intersects(item.rect))
-    {
-      intersects = true;
-      break;
-    }
-  }
-  if (intersects)
-    return;
+QRectF KRender::getClipRect() const
+{
+  return QRectF{QPointF{}, QSizeF{tile_size_pix, tile_size_pix}}
+      .adjusted(-tile_margin_pix, -tile_margin_pix, tile_margin_pix,
+                tile_margin_pix);
+}
 
-  point_names[render_idx].append({rect, str_list, cl});
+void KRender::projectPolygon(const KTileStore& store, int polygon_idx,
+                             QVector<QPointF>& pix)
+{
+  int     count = 0;
+  QPointF origin_m;
+  auto    polygon = store.getPolygonM(polygon_idx, count, origin_m);
+  pix.resize(count);
+  kmath::meters2pix(reinterpret_cast<const float*>(polygon), count,
+                    pix.data(), origin_m, tile_origin_pix,
+                    render_mip);
 }
 
-QPolygon KRender::poly2pix(const KGeoPolygon& polygon)
+QPolygon KRender::toPolygon(const QVector<QPointF>& pix)
 {
-  QPoint   prev_point_pix = deg2pix(polygon.first());
   QPolygon pl;
+  if (pix.isEmpty())
+    return pl;
+
+  auto toPoint = [](const QPointF& p)
+  {
+    return QPoint{int(floor(p.x())), int(floor(p.y()))};
+  };
+  QPoint prev_point_pix = toPoint(pix[0]);
   pl.append(prev_point_pix);
-  for (int i = 1; i < polygon.count(); i++)
+  for (int i = 1; i < pix.count(); i++)
   {
-    auto kpoint    = polygon.at(i);
-    auto point_pix = deg2pix(kpoint);
+    auto point_pix = toPoint(pix[i]);
     auto d         = point_pix - prev_point_pix;
-    if (d.manhattanLength() > 2 || i == polygon.count() - 1)
+    if (d.manhattanLength() > 2 || i == pix.count() - 1)
     {
       pl.append(point_pix);
       prev_point_pix = point_pix;
@@ -358,60 +474,72 @@ QPolygon KRender::poly2pix(const KGeoPolygon& polygon)
   return pl;
 }
 
-void KRender::paintPolygonObject(QPainter* p, const KRenderPack& pack,
-                                 const KObject& obj, int render_idx)
+QPolygon KRender::poly2pix(const KTileStore& store, int polygon_idx)
 {
-  auto  frame = obj.frame;
-  QRect obj_frame_pix;
+  auto& pix = pix_buffer;
+  projectPolygon(store, polygon_idx, pix);
+  auto clip_rect = getClipRect();
+  if (!kmath::isInside(pix, clip_rect))
+    kmath::clipPolygon(pix, clip_rect, clip_buffer);
+  return toPolygon(pix);
+}
 
-  auto   top_left_m     = frame.top_left.toMeters();
-  auto   bottom_right_m = frame.bottom_right.toMeters();
-  QRectF obj_frame_m    = {top_left_m, bottom_right_m};
+QVector<QPolygon> KRender::line2pix(const KTileStore& store,
+                                    int               polygon_idx)
+{
+  auto& pix = pix_buffer;
+  projectPolygon(store, polygon_idx, pix);
+  auto clip_rect = getClipRect();
+  if (kmath::isInside(pix, clip_rect))
+    return {toPolygon(pix)};
+
+  QVector<QPolygon> ret;
+  kmath::clipPolyline(pix, clip_rect, clip_pieces);
+  for (auto& piece: clip_pieces)
+    ret.append(toPolygon(piece));
+  return ret;
+}
 
-  auto cl = &pack.classes[obj.class_idx];
-  if (!obj_frame_m.intersects(render_frame_m))
-    return;
+void KRender::paintPolygonObject(QPainter* p, const KRenderPack& pack,
+                                 const KTileStore&         store,
+                                 const KTileStore::Object& obj,
+                                 int bin_idx, PaintBatch& batch)
+{
+  auto  obj_frame_m   = obj.frame_m;
+  QRect obj_frame_pix = {meters2tilePix(obj_frame_m.topLeft()),
+                         meters2tilePix(obj_frame_m.bottomRight())};
+
+  auto cl = &pack.getClasses()[obj.class_idx];
 
   double obj_span_m   = sqrt(pow(obj_frame_m.width(), 2) +
                              pow(obj_frame_m.height(), 2));
   int    obj_span_pix = obj_span_m / render_mip;
 
-  if (cl->pen == Qt::black)
-    p->setPen(Qt::NoPen);
-  else
-    p->setPen(cl->pen);
-  if (cl->style == KClass::Hatch)
-    p->setBrush(QBrush(cl->brush, Qt::HorPattern));
-  else if (cl->style == KClass::BDiag)
-    p->setBrush(QBrush(cl->brush, Qt::BDiagPattern));
-  else if (cl->style == KClass::FDiag)
-    p->setBrush(QBrush(cl->brush, Qt::FDiagPattern));
-  else if (cl->style == KClass::Horiz)
-    p->setBrush(QBrush(cl->brush, Qt::HorPattern));
-  else if (cl->style == KClass::Vert)
-    p->setBrush(QBrush(cl->brush, Qt::VerPattern));
-  else
-    p->setBrush(cl->brush);
-
-  QPainterPath path;
-  for (int polygon_idx = -1; auto polygon: obj.polygons)
+  bool can_batch = obj.polygon_count == 1 &&
+                   batch.style->polygon_pen.style() == Qt::NoPen;
+  if (!can_batch)
   {
-    polygon_idx++;
-
-    auto pl = poly2pix(polygon);
+    paintBatch(p, batch, 0);
+    p->setPen(batch.style->polygon_pen);
+    p->setBrush(batch.style->polygon_brush);
+  }
 
-    if ((polygon_idx == 0 && !obj.name.isEmpty() &&
-         obj_span_pix < std::min(pixmap_size.width(),
-                                 pixmap_size.height() / 2) &&
-         obj_span_pix >
-             max_object_size_with_name_mm / pixel_size_mm) ||
-        !cl->image.isNull())
+  auto name          = store.getName(obj);
+  auto first_polygon = store.getFirstPolygon(obj, render_mip);
+  bool is_name_bin   = isInTile(obj_frame_pix.center());
+  for (int polygon_idx = 0; polygon_idx < obj.polygon_count;
+       polygon_idx++)
+  {
+    auto pl = poly2pix(store, first_polygon + polygon_idx);
+
+    if (is_name_bin &&
+        ((polygon_idx == 0 && !name.isEmpty() &&
+          obj_span_pix < std::min(pixmap_size.width(),
+                                  pixmap_size.height() / 2) &&
+          obj_span_pix >
+              max_object_size_with_name_mm / pixel_size_mm) ||
+         !cl->image.isNull()))
     {
-
-      QPoint top_left_pix     = deg2pix(obj.frame.top_left);
-      QPoint bottom_right_pix = deg2pix(obj.frame.bottom_right);
-      obj_frame_pix           = {top_left_pix, bottom_right_pix};
-
       auto  c = obj_frame_pix.center();
       QRect actual_rect;
       int   w = pixmap_size.width() / 32;
@@ -419,12 +547,20 @@ void KRender::paintPolygonObject(QPainter* p, const KRenderPack& pack,
       actual_rect.setSize({w, w});
       actual_rect.translate({-w / 2, -w / 2});
 
-      addDrawTextEntry(draw_text_array[render_idx],
-                       {obj.name, cl, obj_frame_pix, actual_rect,
-                        Qt::AlignCenter});
+      bins[bin_idx].labels.draw_text_array.append(
+          {name, cl, obj_frame_pix, actual_rect, Qt::AlignCenter,
+           obj.class_idx});
+    }
+
+    if (can_batch)
+    {
+      if (getSignedArea(pl) < 0)
+        std::reverse(pl.begin(), pl.end());
+      batch.path.addPolygon(pl);
+      continue;
     }
 
-    if (obj.polygons.count() == 1)
+    if (obj.polygon_count == 1)
     {
       p->drawPolygon(pl);
       continue;
@@ -440,226 +576,205 @@ void KRender::paintPolygonObject(QPainter* p, const KRenderPack& pack,
   }
 }
 
-void KRender::paintLineObject(QPainter*          painter,
-                              const KRenderPack& pack,
-                              const KObject& obj, int render_idx,
-                              int line_iter)
+void KRender::paintLineObject(QPainter*                 painter,
+                              const KRenderPack&        pack,
+                              const KTileStore&         store,
+                              const KTileStore::Object& obj,
+                              int bin_idx, int line_iter,
+                              PaintBatch& batch)
 {
-  auto frame = obj.frame;
-
-  auto top_left_m     = frame.top_left.toMeters();
-  auto bottom_right_m = frame.bottom_right.toMeters();
-
-  QRectF obj_frame_m = {top_left_m, bottom_right_m};
-
-  if (!obj_frame_m.intersects(render_frame_m))
-    return;
-
-  auto cl = &pack.classes[obj.class_idx];
-
-  Qt::PenStyle style = Qt::SolidLine;
-  if (cl->style == KClass::Dash)
-    style = Qt::DashLine;
-  if (cl->style == KClass::Dots)
-    style = Qt::DotLine;
-  int obj_name_width = 0;
-  if (!obj.name.isEmpty())
-    obj_name_width =
-        painter->font().pixelSize() * obj.name.count() * 0.3;
-
-  auto         fixed_w    = cl->getWidthPix();
-  int          sizeable_w = 0;
-  int          w          = fixed_w;
-  bool         one_way    = false;
-  QMapIterator it(obj.attributes);
-  while (it.hasNext())
+  auto cl = &pack.getClasses()[obj.class_idx];
+
+  auto style          = getPenStyle(*cl);
+  auto name           = store.getName(obj);
+  int  obj_name_width = 0;
+  if (!name.isEmpty())
+    obj_name_width = painter->font().pixelSize() * name.count() * 0.3;
+
+  auto fixed_w    = cl->getWidthPix();
+  int  sizeable_w = 0;
+  int  w          = fixed_w;
+  bool one_way    = store.findAttribute(obj, "oneway") >= 0;
+  if (auto lanes_idx = store.findAttribute(obj, "lanes");
+      lanes_idx >= 0)
   {
-    it.next();
-    if (it.key() == "oneway")
-      one_way = true;
-
-    if (it.key() == "lanes")
-    {
-      sizeable_w = 4 * it.value().toInt() / mip;
-      w          = std::max((int)fixed_w, sizeable_w);
-    }
+    sizeable_w =
+        4 * store.getString(lanes_idx).toInt() / render_mip;
+    w          = std::max((int)fixed_w, sizeable_w);
   }
 
-  painter->setPen(QPen(cl->pen, w, style));
-  painter->setBrush(Qt::NoBrush);
+  bool can_batch = sizeable_w == 0 && cl->style != KClass::Hatch;
+  if (!can_batch)
+    paintBatch(painter, batch, line_iter);
 
-  for (int poly_idx = -1; auto polygon: obj.polygons)
+  auto first_polygon = store.getFirstPolygon(obj, render_mip);
+  for (int poly_idx = 0; poly_idx < obj.polygon_count; poly_idx++)
   {
-    poly_idx++;
-    NameHolder nh;
-    QPoint     p0;
-    double     a0 = 0;
-
-    auto pl = poly2pix(polygon);
+    auto polygon_idx = first_polygon + poly_idx;
+    auto size_m      = store.getPolygonRectM(polygon_idx).size();
+    auto size_pix =
+        (size_m.width() + size_m.height()) / render_mip;
+    for (auto pl: line2pix(store, polygon_idx))
+    {
+      NameHolder nh;
+      QPoint     p0;
+      double     a0 = 0;
 
-    auto size_m       = polygon.getFrame().getSizeMeters();
-    auto size_pix     = (size_m.width() + size_m.height()) / mip;
-    auto hatch_length = size_pix * 0.05;
-    if (hatch_length > 5)
-      if (cl->style == KClass::Hatch)
-      {
-        if (hatch_length > 5)
-          hatch_length = 5;
-        auto p0 = pl.first();
-        for (int c = -1; auto p: pl)
+      auto hatch_length = size_pix * 0.05;
+      if (hatch_length > 5)
+        if (cl->style == KClass::Hatch)
         {
-          c++;
-          double a = 0;
-          if (c == 0)
-            a = getAngle(p0, pl.at(1));
-          else
-            a = getAngle(p0, p);
-          painter->save();
-          painter->translate(p);
-          painter->rotate(rad2deg(a));
-          int length = getDistance(p0, p);
-          int step   = 10;
-          for (int l = 0; l < length; l += step)
+          if (hatch_length > 5)
+            hatch_length = 5;
+          painter->setPen(QPen(cl->pen, w, style));
+          auto p0 = pl.first();
+          for (int c = -1; auto p: pl)
           {
-            painter->drawLine(0, 0, 0, hatch_length);
-            painter->translate(-step, 0);
+            c++;
+            double a = 0;
+            if (c == 0)
+              a = getAngle(p0, pl.at(1));
+            else
+              a = getAngle(p0, p);
+            painter->save();
+            painter->translate(p);
+            painter->rotate(rad2deg(a));
+            int length = getDistance(p0, p);
+            int step   = 10;
+            for (int l = 0; l < length; l += step)
+            {
+              painter->drawLine(0, 0, 0, hatch_length);
+              painter->translate(-step, 0);
+            }
+            painter->restore();
+            p0 = p;
           }
-          painter->restore();
-          p0 = p;
         }
-      }
 
-    if (!obj.name.isEmpty() && poly_idx == 0)
-      for (int point_idx = -1; auto p: pl)
-      {
-        point_idx++;
-        if (nh.point_count == 0)
+      if (!name.isEmpty() && poly_idx == 0)
+        for (int point_idx = -1; auto p: pl)
         {
-          p0 = p;
-          nh.point_count++;
-          continue;
-        }
-        auto a = getAngle(p0, p);
-
-        if (nh.point_count == 1)
-          a0 = a;
-        auto da = a0 - a;
-        if (da > M_PI)
-          da -= 2 * M_PI;
-        else if (da < -M_PI)
-          da += 2 * M_PI;
-        da = fabs(da);
-        if (da > deg2rad(5) || point_idx == polygon.count() - 1)
-        {
-          if (nh.length_pix > obj_name_width)
+          point_idx++;
+          if (nh.point_count == 0)
           {
-            nh.fix(&pack, &obj, pl.at(nh.start_idx),
-                   pl.at(nh.end_idx));
-            name_holder_array[render_idx].append(nh);
+            p0 = p;
+            nh.point_count++;
+            continue;
           }
-          nh           = NameHolder();
-          nh.start_idx = point_idx;
-          p0           = p;
-          continue;
+          auto a = getAngle(p0, p);
+
+          if (nh.point_count == 1)
+            a0 = a;
+          auto da = a0 - a;
+          if (da > M_PI)
+            da -= 2 * M_PI;
+          else if (da < -M_PI)
+            da += 2 * M_PI;
+          da = fabs(da);
+          if (da > deg2rad(5) || point_idx == pl.count() - 1)
+          {
+            if (nh.length_pix > obj_name_width)
+            {
+              nh.fix(cl, name, pl.at(nh.start_idx),
+                     pl.at(nh.end_idx));
+              nh.class_idx = obj.class_idx;
+              if (isInTile(nh.mid_point))
+                bins[bin_idx].labels.name_holder_array.append(nh);
+            }
+            nh           = NameHolder();
+            nh.start_idx = point_idx;
+            p0           = p;
+            continue;
+          }
+          auto length_pix = getDistance(p0, p);
+          nh.length_pix += length_pix;
+          p0 = p;
+          nh.point_count++;
+          nh.end_idx = point_idx;
         }
-        auto length_pix = getDistance(p0, p);
-        nh.length_pix += length_pix;
-        p0 = p;
-        nh.point_count++;
-        nh.end_idx = point_idx;
+
+      if (can_batch)
+      {
+        batch.path.addPolygon(pl);
+        continue;
       }
 
-    QPen pen;
-    if (line_iter == 0)
-    {
-      double coef = 2;
-      if (w > 20)
-        coef = 1.5;
-      if (w > 50)
-        coef = 1.2;
-      int w2 = w * coef;
-      pen    = QPen(cl->brush, w2, Qt::SolidLine, Qt::FlatCap,
-                    Qt::RoundJoin);
-    }
-    else
-      pen = QPen(cl->pen, w, style, Qt::FlatCap, Qt::RoundJoin);
-    painter->setPen(pen);
-    painter->drawPolyline(pl);
-    if (sizeable_w > 7 && w > 0)
-    {
-      painter->setPen(Qt::black);
-      auto orig_f = painter->font();
-      auto f      = orig_f;
-      f.setPixelSize(w);
-      painter->setFont(f);
-      if (pl.count() > 1 && sizeable_w > 7 && one_way)
+      auto pen = line_iter == 0 ? batch.style->casing_pen
+                                : batch.style->line_pen;
+      pen.setWidth(line_iter == 0 ? int(w * getCasingCoef(w)) : w);
+      painter->setPen(pen);
+      painter->setBrush(Qt::NoBrush);
+      painter->drawPolyline(pl);
+      if (sizeable_w > 7 && w > 0)
       {
-        auto p0 = pl.first();
-        for (int i = 1; i < pl.count(); i++)
+        painter->setPen(Qt::black);
+        auto orig_f = painter->font();
+        auto f      = orig_f;
+        f.setPixelSize(w);
+        painter->setFont(f);
+        if (pl.count() > 1 && sizeable_w > 7 && one_way)
         {
-          auto   p1  = pl.at(i);
-          auto   a   = getAngle(p0, p1);
-          QPoint mid = {(p0.x() + p1.x()) / 2, (p0.y() + p1.y()) / 2};
-          painter->save();
-          painter->translate(mid);
-          painter->rotate(rad2deg(a));
-          painter->drawText(0, w * 0.3, "→");
-          painter->restore();
-          p0 = p1;
+          auto p0 = pl.first();
+          for (int i = 1; i < pl.count(); i++)
+          {
+            auto   p1  = pl.at(i);
+            auto   a   = getAngle(p0, p1);
+            QPoint mid = {(p0.x() + p1.x()) / 2,
+                          (p0.y() + p1.y()) / 2};
+            painter->save();
+            painter->translate(mid);
+            painter->rotate(rad2deg(a));
+            painter->drawText(0, w * 0.3, "→");
+            painter->restore();
+            p0 = p1;
+          }
         }
+        painter->setFont(orig_f);
       }
-      painter->setFont(orig_f);
     }
   }
 }
 
-void KRender::NameHolder::fix(const KPack* pack, const KObject* _obj,
+void KRender::NameHolder::fix(const KClass* _cl, QString _name,
                               const QPoint& start, const QPoint& end)
 {
-  obj       = _obj;
+  cl        = _cl;
+  name      = _name;
   mid_point = {(start.x() + end.x()) / 2, (start.y() + end.y()) / 2};
   angle_deg = rad2deg(getAngle(start, end));
   if (angle_deg > 90)
     angle_deg -= 180;
   if (angle_deg < -90)
     angle_deg += 180;
-  tcolor = pack->classes[_obj->class_idx].tcolor;
-}
-
-bool KRender::isCluttering(const QRect& rect)
-{
-  bool clutter_flag = false;
-  for (auto ex_rect: text_rect_array)
-    if (ex_rect.intersects(rect))
-    {
-      clutter_flag = true;
-      break;
-    }
-  return clutter_flag;
+  tcolor = cl->tcolor;
 }
 
-bool KRender::checkMipRange(const KPack* pack, const KObject* obj)
+bool KRender::checkMipRange(const KRenderPack*        pack,
+                            const KTileStore::Object* obj)
 {
-  auto cl = &pack->classes[obj->class_idx];
+  auto cl = &pack->getClasses()[obj->class_idx];
   return (cl->min_mip == 0 || render_mip >= cl->min_mip) &&
          (cl->max_mip == 0 || render_mip <= cl->max_mip);
 }
 
 bool KRender::paintObject(QPainter* p, const KRenderPack* map,
-                          const KObject& obj, int render_idx,
-                          int line_iter)
+                          const KRenderPack::RenderObject& ro,
+                          int bin_idx, int line_iter,
+                          PaintBatch& batch)
 {
-  auto cl = &map->classes[obj.class_idx];
+  auto& obj = *ro.obj;
+  auto  cl  = &map->getClasses()[obj.class_idx];
   switch (cl->type)
   {
   case KClass::Point:
-    paintPointObject(p, *map, obj, render_idx);
+    paintPointObject(p, *map, *ro.store, obj, bin_idx);
     break;
   case KClass::Line:
-    paintLineObject(p, *map, obj, render_idx, line_iter);
+    paintLineObject(p, *map, *ro.store, obj, bin_idx, line_iter,
+                    batch);
     break;
   case KClass::Polygon:
-    paintPolygonObject(p, *map, obj, render_idx);
+    paintPolygonObject(p, *map, *ro.store, obj, bin_idx, batch);
     break;
   default:
     break;
@@ -686,233 +801,390 @@ void KRender::checkYieldResult()
 
 bool KRender::paintPointNames(QPainter* p)
 {
-  for (int render_idx = 0; render_idx < KRenderPack::render_count;
-       render_idx++)
-    for (auto item: point_names[render_idx])
+  point_grid.init({{0, 0}, pixmap_size}, label_cell_size_pix);
+  for (auto item: labels.point_names)
+  {
+    if (!point_grid.tryInsert(item.rect))
+      continue;
+    auto pos = item.rect.topLeft();
+    auto w   = item.cl->getWidthPix();
+    if (w > 0)
     {
-      auto pos = item.rect.topLeft();
-      auto w   = item.cl->getWidthPix();
-      if (w > 0)
-      {
-        p->save();
-        p->translate(pos);
-        auto f = p->font();
-        f.setPixelSize(w);
-        p->setFont(f);
-        for (auto str: item.str_list)
-        {
-          p->translate(
-              QPoint(item.cl->image.width() * 0.8, -w * 0.3));
-          paintPointName(p, str, item.cl->tcolor);
-        }
-        p->restore();
-      }
-      if (item.cl)
+      p->save();
+      p->translate(pos);
+      auto f = p->font();
+      f.setPixelSize(w);
+      p->setFont(f);
+      for (auto str: item.str_list)
       {
-        auto pos2 = QPoint{pos.x() - item.cl->image.width() / 2,
-                           pos.y() - item.cl->image.height() / 2};
-        p->drawImage(pos2, item.cl->image);
+        p->translate(QPoint(item.cl->image.width() * 0.8, -w * 0.3));
+        auto sprite =
+            getLabelSprite(p->font(), str, item.cl->tcolor, 0,
+                           getPointNameSize(), point_name_flags);
+        p->drawImage(-sprite.origin, sprite.image);
       }
-      else
-        p->drawEllipse(pos, int(1.0 / pixel_size_mm),
-                       int(1.0 / pixel_size_mm));
-      if (!canContinue())
-        return false;
+      p->restore();
+    }
+    if (item.cl)
+    {
+      auto pos2 = QPoint{pos.x() - item.cl->image.width() / 2,
+                         pos.y() - item.cl->image.height() / 2};
+      p->drawImage(pos2, item.cl->image);
     }
+    else
+      p->drawEllipse(pos, int(1.0 / pixel_size_mm),
+                     int(1.0 / pixel_size_mm));
+    if (!canContinue())
+      return false;
+  }
   return true;
 }
 
 bool KRender::paintLineNames(QPainter* p)
 {
-  text_rect_array.clear();
+  label_grid.init({{0, 0}, pixmap_size}, label_cell_size_pix);
   auto f = p->font();
   auto w = round(1.5 / pixel_size_mm);
   f.setPixelSize(w);
   p->setFont(f);
 
-  for (int render_idx = 0; render_idx < KRenderPack::render_count;
-       render_idx++)
-    for (auto nh: name_holder_array[render_idx])
-    {
-      p->save();
-      QRect text_rect;
-      text_rect.setSize(
-          {int(p->font().pixelSize() * nh.obj->name.count() * 0.6),
-           p->font().pixelSize()});
-
-      QTransform tr;
-      tr.translate(nh.mid_point.x(), nh.mid_point.y());
-      tr.rotate(nh.angle_deg);
-      tr.translate(-text_rect.width() / 2, 0);
-
-      QRect mapped_rect = tr.mapRect(text_rect);
-      if (isCluttering(mapped_rect))
-      {
-        p->restore();
-        continue;
-      }
+  for (auto nh: labels.name_holder_array)
+  {
+    QRect text_rect;
+    text_rect.setSize(
+        {int(p->font().pixelSize() * nh.name.count() * 0.6),
+         p->font().pixelSize()});
+
+    QTransform tr;
+    tr.translate(nh.mid_point.x(), nh.mid_point.y());
+    tr.rotate(nh.angle_deg);
+    tr.translate(-text_rect.width() / 2, 0);
+
+    QRect mapped_rect = tr.mapRect(text_rect);
+    if (!label_grid.tryInsert(mapped_rect))
+      continue;
 
-      p->setTransform(tr);
-      text_rect_array.append(mapped_rect);
-      paintOutlinedText(p, nh.obj->name, nh.tcolor);
-      p->restore();
-      if (!canContinue())
-        return false;
-    }
+    auto sprite = getLabelSprite(p->font(), nh.name, nh.tcolor,
+                                 nh.angle_deg, QSize(), 0);
+    auto pos = tr.map(QPoint(0, 0)) - sprite.origin;
+    p->drawImage(pos, sprite.image);
+    if (!canContinue())
+      return false;
+  }
   return true;
 }
 
 bool KRender::paintPolygonNames(QPainter* p)
 {
-  for (int render_idx = 0; render_idx < KRenderPack::render_count;
-       render_idx++)
-    for (auto& dte: draw_text_array[render_idx])
-    {
-      QFontMetrics fm(p->font());
-      auto         actual_rect = fm.boundingRect(
-                  dte.actual_rect,
-                  Qt::AlignLeft | Qt::TextWordWrap | Qt::TextDontClip,
-                  dte.text);
-      if (actual_rect.width() > dte.actual_rect.width() * 1.5 &&
-          actual_rect.height() > dte.actual_rect.height() * 1.5)
-        continue;
-
-      if (isCluttering(actual_rect))
-        continue;
-      paintOutlinedText(p, dte);
-
-      if (!dte.cl->image.isNull() &&
-          dte.rect.width() > dte.cl->image.width() * 2 &&
-          dte.rect.height() > dte.cl->image.height() * 2)
-      {
-        auto obj_center = dte.rect.center();
-        auto pos =
-            QPoint{obj_center.x() - dte.cl->image.width() / 2,
-                   obj_center.y() - dte.cl->image.height() / 2};
-        if (!dte.text.isEmpty())
-          pos -= QPoint(0, dte.cl->getWidthPix() + 5);
-        p->drawImage(pos, dte.cl->image);
-      }
+  for (auto& dte: labels.draw_text_array)
+  {
+    QFontMetrics fm(p->font());
+    auto         actual_rect = fm.boundingRect(
+                dte.actual_rect,
+                Qt::AlignLeft | Qt::TextWordWrap | Qt::TextDontClip,
+                dte.text);
+    if (actual_rect.width() > dte.actual_rect.width() * 1.5 &&
+        actual_rect.height() > dte.actual_rect.height() * 1.5)
+      continue;
 
-      text_rect_array.append(dte.rect);
-      if (!canContinue())
-        return false;
+    if (label_grid.intersects(actual_rect))
+      continue;
+    auto sprite = getLabelSprite(
+        p->font(), dte.text, dte.cl->tcolor, 0, dte.rect.size(),
+        dte.alignment | Qt::TextWordWrap | Qt::TextDontClip);
+    p->drawImage(dte.rect.topLeft() - sprite.origin, sprite.image);
+
+    if (!dte.cl->image.isNull() &&
+        dte.rect.width() > dte.cl->image.width() * 2 &&
+        dte.rect.height() > dte.cl->image.height() * 2)
+    {
+      auto obj_center = dte.rect.center();
+      auto pos =
+          QPoint{obj_center.x() - dte.cl->image.width() / 2,
+                 obj_center.y() - dte.cl->image.height() / 2};
+      if (!dte.text.isEmpty())
+        pos -= QPoint(0, dte.cl->getWidthPix() + 5);
+      p->drawImage(pos, dte.cl->image);
     }
+
+    label_grid.insert(dte.rect);
+    if (!canContinue())
+      return false;
+  }
   return true;
 }
 
-void KRender::render(QPainter* p, QVector<KRenderPack*> render_packs,
-                     int render_idx)
+void KRender::renderPack(QPainter* p, const KRenderPack* pack,
+                         const QVector<ClassStyle>& styles,
+                         const QVector<int>&        object_idx_list,
+                         int bin_idx, int line_iter)
 {
-  for (auto map: render_packs)
+  p->setRenderHint(QPainter::Antialiasing);
+  PaintBatch batch;
+  for (auto obj_idx: object_idx_list)
   {
-    KLocker main_locker(&map->main_lock, KLocker::Read);
-    if (!main_locker.hasLocked())
+    auto& ro = pack->visible_objects[obj_idx];
+    auto  cl = &pack->getClasses()[ro.obj->class_idx];
+
+    if (cl->type != KClass::Line && line_iter == 1)
       continue;
-    KLocker tile_locker(&map->tile_lock, KLocker::Read);
-    if (!tile_locker.hasLocked())
+
+    if (cl->type == KClass::Line && line_iter == 0 &&
+        cl->brush == Qt::black)
       continue;
 
-    for (int line_iter = 0; line_iter < 2; line_iter++)
-      renderPack(p, map, render_idx, line_iter);
+    if (cl->type != batch.type ||
+        batch.style != &styles[ro.obj->class_idx])
+    {
+      paintBatch(p, batch, line_iter);
+      batch.style = &styles[ro.obj->class_idx];
+      batch.type  = cl->type;
+    }
+
+    if (!paintObject(p, pack, ro, bin_idx, line_iter, batch))
+    {
+      emit rendered(0);
+      return;
+    }
   }
+  paintBatch(p, batch, line_iter);
 }
 
-void KRender::renderPack(QPainter* p, const KRenderPack* pack,
-                         int render_idx, int line_iter)
+KRender::PaintBatch::PaintBatch()
+{
+  path.setFillRule(Qt::WindingFill);
+}
+
+void KRender::paintBatch(QPainter* p, PaintBatch& batch,
+                         int line_iter)
 {
-  if (!pack || render_idx > pack->render_start_list.count() - 1)
+  if (batch.path.isEmpty())
     return;
+  if (batch.type == KClass::Polygon)
+  {
+    p->setPen(Qt::NoPen);
+    p->setBrush(batch.style->polygon_brush);
+  }
+  else
+  {
+    p->setPen(line_iter == 0 ? batch.style->casing_pen
+                             : batch.style->line_pen);
+    p->setBrush(Qt::NoBrush);
+  }
+  p->drawPath(batch.path);
+  batch.path = QPainterPath();
+  batch.path.setFillRule(Qt::WindingFill);
+}
 
-  auto start        = pack->render_start_list[render_idx];
-  int  object_count = 0;
+Qt::PenStyle KRender::getPenStyle(const KClass& cl)
+{
+  if (cl.style == KClass::Dash)
+    return Qt::DashLine;
+  if (cl.style == KClass::Dots)
+    return Qt::DotLine;
+  return Qt::SolidLine;
+}
 
-  p->setRenderHint(QPainter::Antialiasing);
-  for (int layer_idx = start.layer_idx;
-       layer_idx < KRenderPack::max_layer_count; layer_idx++)
+double KRender::getCasingCoef(int w)
+{
+  if (w > 50)
+    return 1.2;
+  if (w > 20)
+    return 1.5;
+  return 2;
+}
+
+qint64 KRender::getSignedArea(const QPolygon& pl)
+{
+  qint64 area = 0;
+  for (int i = 0; i < pl.count(); i++)
   {
-    int start_obj_idx = 0;
-    if (layer_idx == start.layer_idx)
-      start_obj_idx = start.obj_idx;
-    auto& layer     = pack->render_data[layer_idx];
-    auto  obj_count = layer.count();
+    auto& p0 = pl.at(i);
+    auto& p1 = pl.at((i + 1) % pl.count());
+    area += qint64(p0.x()) * p1.y() - qint64(p1.x()) * p0.y();
+  }
+  return area;
+}
 
-    for (int obj_idx = start_obj_idx; obj_idx < obj_count; obj_idx++)
-    {
-      auto obj = layer[obj_idx];
-      object_count++;
-      if (object_count == pack->render_object_count)
-        return;
-      if (!obj)
-        continue;
+KRender::ClassStyle KRender::createClassStyle(const KClass& cl)
+{
+  ClassStyle cs;
+  if (cl.pen == Qt::black)
+    cs.polygon_pen = QPen(Qt::NoPen);
+  else
+    cs.polygon_pen = QPen(cl.pen);
+  if (cl.style == KClass::Hatch)
+    cs.polygon_brush = QBrush(cl.brush, Qt::HorPattern);
+  else if (cl.style == KClass::BDiag)
+    cs.polygon_brush = QBrush(cl.brush, Qt::BDiagPattern);
+  else if (cl.style == KClass::FDiag)
+    cs.polygon_brush = QBrush(cl.brush, Qt::FDiagPattern);
+  else if (cl.style == KClass::Horiz)
+    cs.polygon_brush = QBrush(cl.brush, Qt::HorPattern);
+  else if (cl.style == KClass::Vert)
+    cs.polygon_brush = QBrush(cl.brush, Qt::VerPattern);
+  else
+    cs.polygon_brush = QBrush(cl.brush);
+
+  int w         = cl.getWidthPix();
+  cs.line_pen   = QPen(cl.pen, w, getPenStyle(cl), Qt::FlatCap,
+                       Qt::RoundJoin);
+  cs.casing_pen = QPen(cl.brush, int(w * getCasingCoef(w)),
+                       Qt::SolidLine, Qt::FlatCap, Qt::RoundJoin);
+  return cs;
+}
 
-      auto cl = &pack->classes[obj->class_idx];
+QPoint KRender::getTile(QPointF m) const
+{
+  auto pix = meters2tilePix(m) + tile_origin_pix;
+  return {int(floor(1.0 * pix.x() / tile_size_pix)),
+          int(floor(1.0 * pix.y() / tile_size_pix))};
+}
 
-      if (cl->type != KClass::Line && line_iter == 1)
-        continue;
+KTileCache::Key KRender::getTileKey(QPoint tile) const
+{
+  return {qRound64(log2(render_mip) * 1e6), tile.x(), tile.y(),
+          render_generation};
+}
 
-      if (cl->type == KClass::Line && line_iter == 0 &&
-          cl->brush == Qt::black)
-        continue;
+QRectF KRender::getTileRectM(QPoint tile) const
+{
+  return {QPointF(tile * tile_size_pix) * render_mip,
+          QSizeF(tile_size_pix, tile_size_pix) * render_mip};
+}
 
-      if (!checkMipRange(pack, obj))
-        continue;
+double KRender::getTileMarginM() const
+{
+  return tile_margin_pix * std::max(1.0, render_mip);
+}
 
-      if (!paintObject(p, pack, *obj, render_idx, line_iter))
+void KRender::createBins()
+{
+  bins.clear();
+  QPointF last_pix_m =
+      render_top_left_m + QPointF(pixmap_size.width() - 1,
+                                  pixmap_size.height() - 1) *
+                              render_mip;
+  first_tile     = getTile(render_top_left_m);
+  auto last_tile = getTile(last_pix_m);
+  bin_cols       = last_tile.x() - first_tile.x() + 1;
+  for (int y = first_tile.y(); y <= last_tile.y(); y++)
+    for (int x = first_tile.x(); x <= last_tile.x(); x++)
+    {
+      RenderBin bin;
+      bin.tile = {x, y};
+      bin.rect = {bin.tile * tile_size_pix - frame_origin_pix,
+                  QSize(tile_size_pix, tile_size_pix)};
+      KTileCache::Tile tile;
+      if (tile_cache.find(getTileKey(bin.tile), tile))
       {
-        emit rendered(0);
-        return;
+        bin.is_cached = true;
+        bin.image     = tile.image;
+        bin.labels    = loadLabels(tile.labels);
       }
+      bins.append(bin);
     }
-  }
 }
 
-struct RenderEntry
+void KRender::binObjects()
 {
-  int            idx;
-  QPixmap*       pm;
-  QPainter*      p;
-  QElapsedTimer* t;
-  QFuture<void>* fut;
-  RenderEntry(int idx, QSize s, QFont* f);
-  ~RenderEntry();
-};
+  for (auto& bin: bins)
+    bin.object_idx_list.resize(render_packs.count());
 
-RenderEntry::RenderEntry(int _idx, QSize size, QFont* f)
-{
-  idx = _idx;
-  pm  = new QPixmap(size);
-  pm->fill(Qt::transparent);
-  p = new QPainter(pm);
-  p->setFont(*f);
-  t = new QElapsedTimer;
-  t->start();
-  fut = new QFuture<void>;
+  auto   last_tile = bins.last().tile;
+  double margin_m  = getTileMarginM();
+  for (int pack_idx = -1; auto pack: render_packs)
+  {
+    pack_idx++;
+    for (int obj_idx = -1; auto& ro: pack->visible_objects)
+    {
+      obj_idx++;
+      auto obj = ro.obj;
+      auto cl  = &pack->getClasses()[obj->class_idx];
+      if (cl->type == KClass::None || !checkMipRange(pack, obj))
+        continue;
+
+      auto tl = obj->frame_m.topLeft();
+      auto br = obj->frame_m.bottomRight();
+      if (cl->type == KClass::Point)
+        br = tl;
+      else
+      {
+        tl -= QPointF{margin_m, margin_m};
+        br += QPointF{margin_m, margin_m};
+      }
+      auto from = getTile(tl);
+      auto to   = getTile(br);
+      for (int y = std::max(from.y(), first_tile.y());
+           y <= std::min(to.y(), last_tile.y()); y++)
+        for (int x = std::max(from.x(), first_tile.x());
+             x <= std::min(to.x(), last_tile.x()); x++)
+        {
+          auto& bin = bins[(y - first_tile.y()) * bin_cols + x -
+                           first_tile.x()];
+          if (!bin.is_cached)
+            bin.object_idx_list[pack_idx].append(obj_idx);
+        }
+    }
+  }
 }
 
-RenderEntry::~RenderEntry()
+void KRender::renderBins()
 {
-  delete p;
-  delete pm;
-  delete t;
-  delete fut;
+  int bin_idx = 0;
+  while ((bin_idx = next_bin_idx.fetchAndAddRelaxed(1)) <
+         bins.count())
+  {
+    if (!canContinue())
+      return;
+    renderBin(bin_idx);
+  }
 }
 
-void KRender::run()
+void KRender::renderBin(int bin_idx)
 {
-  render_center_m = center_m;
-  render_mip      = mip;
+  auto& bin      = bins[bin_idx];
+  bool  is_empty = true;
+  for (auto& object_idx_list: bin.object_idx_list)
+    if (!object_idx_list.isEmpty())
+      is_empty = false;
+  if (bin.is_cached || is_empty)
+    return;
 
-  for (int i = 0; i < KRenderPack::render_count; i++)
+  bin.image = QImage(tile_size_pix, tile_size_pix,
+                     QImage::Format_ARGB32_Premultiplied);
+  bin.image.fill(Qt::transparent);
+  QPainter p(&bin.image);
+  p.setFont(font);
+  tile_origin_pix = bin.tile * tile_size_pix;
+
+  for (int pack_idx = -1; auto pack: render_packs)
   {
-    point_names[i].clear();
-    draw_text_array[i].clear();
-    name_holder_array[i].clear();
+    pack_idx++;
+    auto& object_idx_list = bin.object_idx_list[pack_idx];
+    if (object_idx_list.isEmpty())
+      continue;
+
+    for (int line_iter = 0; line_iter < 2; line_iter++)
+      renderPack(&p, pack, class_styles[pack_idx], object_idx_list,
+                 bin_idx, line_iter);
   }
-  size_m            = {pixmap_size.width() * render_mip,
-                       pixmap_size.height() * render_mip};
-  render_top_left_m = {render_center_m.x() - size_m.width() / 2,
-                       render_center_m.y() - size_m.height() / 2};
+}
+
+void KRender::run()
+{
+  render_mip   = mip;
+  render_stamp = QDateTime::currentMSecsSinceEpoch();
+
+  size_m = {pixmap_size.width() * render_mip,
+            pixmap_size.height() * render_mip};
+  QPointF half_size_m = {size_m.width() / 2, size_m.height() / 2};
+  auto    top_left_m  = center_m - half_size_m;
+
+  frame_origin_pix  = {int(floor(top_left_m.x() / render_mip)),
+                       int(floor(top_left_m.y() / render_mip))};
+  render_top_left_m = QPointF(frame_origin_pix) * render_mip;
+  render_center_m   = render_top_left_m + half_size_m;
   render_frame_m    = {render_top_left_m, size_m};
 
   started(render_frame_m);
@@ -940,6 +1212,21 @@ void KRender::run()
   f.setPixelSize(font_size);
   f.setBold(true);
   p0.setFont(f);
+  font = f;
+
+  render_generation = data_generation.loadRelaxed();
+  removeDirtyTiles();
+  for (auto pack: packs)
+    pack->pinSnapshot();
+  labels.clear();
+  createBins();
+
+  QVector<QRectF> missing_rects_m;
+  double          margin_m = getTileMarginM();
+  for (auto& bin: bins)
+    if (!bin.is_cached)
+      missing_rects_m.append(getTileRectM(bin.tile).adjusted(
+          -margin_m, -margin_m, margin_m, margin_m));
 
   QVector<int> intersecting_packs;
   auto         draw_rect = getDrawRectM();
@@ -955,7 +1242,7 @@ void KRender::run()
       intersecting_packs.append(pack_idx);
   }
 
-  QVector<KRenderPack*> render_packs;
+  render_packs.clear();
   for (int pack_idx = -1; auto& pack: packs)
   {
     pack_idx++;
@@ -964,10 +1251,6 @@ void KRender::run()
       if (!intersecting_packs.contains(pack_idx))
         continue;
 
-    KLocker big_locker(&pack->main_lock, KLocker::Read);
-    if (!big_locker.hasLocked())
-      continue;
-
     if (pack_idx > 0 && !needToLoadPack(pack, render_frame_m))
       continue;
 
@@ -975,43 +1258,55 @@ void KRender::run()
     if (pack_idx > 0 && !render_frame_m.intersects(pack_rect_m))
       continue;
 
-    KLocker small_locker(&pack->tile_lock, KLocker::Read);
-    if (!small_locker.hasLocked())
-      continue;
-
-    if (pack->render_start_list.isEmpty())
+    pack->markUsed(render_frame_m, render_stamp);
+    pack->updateVisibleObjects(missing_rects_m);
+    if (pack->visible_objects.isEmpty())
       continue;
 
     render_packs.append(pack);
   }
 
-  QList<RenderEntry*> render_list;
-  for (int render_idx = 1; render_idx < KRenderPack::render_count;
-       render_idx++)
+  class_styles.clear();
+  for (auto pack: render_packs)
   {
-    auto render =
-        new RenderEntry(render_idx, render_pixmap.size(), &f);
-    *render->fut = QtConcurrent::run(
-        this, &KRender::render, render->p, render_packs, render_idx);
-    render_list.append(render);
+    QVector<ClassStyle> styles;
+    for (auto& cl: pack->getClasses())
+      styles.append(createClassStyle(cl));
+    class_styles.append(styles);
   }
 
-  render(&p0, render_packs, 0);
-
-  checkYieldResult();
-
-  for (auto render: render_list)
-    render->fut->waitForFinished();
-
-  for (auto render: render_list)
-    p0.drawPixmap(0, 0, *render->pm);
-
-  qDeleteAll(render_list);
+  binObjects();
+  next_bin_idx = 0;
+  for (int i = 0; i < render_pool.maxThreadCount(); i++)
+    render_pool.start(
+        [this]()
+        {
+          renderBins();
+        });
+  renderBins();
+  render_pool.waitForDone();
+
+  bool  can_cache  = rendering_enabled;
+  QRect label_rect = QRect{{0, 0}, pixmap_size}.adjusted(
+      -tile_size_pix, -tile_size_pix, tile_size_pix, tile_size_pix);
+  for (auto& bin: bins)
+  {
+    if (!bin.is_cached && can_cache)
+      tile_cache.insert(getTileKey(bin.tile),
+                        {bin.image, saveLabels(bin.labels)});
+    if (!bin.image.isNull())
+      p0.drawImage(bin.rect.topLeft(), bin.image);
+    bin.labels.translate(bin.rect.topLeft(), label_rect);
+    labels.append(bin.labels);
+  }
+  bins.clear();
+  labels.sort();
 
   checkYieldResult();
 
   QElapsedTimer t;
   t.start();
+  label_cache.resetCounters();
 
   if (!paintLineNames(&p0))
   {
@@ -1030,7 +1325,9 @@ void KRender::run()
   }
 
   qDebug() << "mip" << render_mip << ",total render time elapsed"
-           << total_render_time.elapsed();
+           << total_render_time.elapsed() << ",labels" << t.elapsed()
+           << ",sprite hits" << label_cache.getHitCount() << "misses"
+           << label_cache.getMissCount();
 
   main_pixmap = render_pixmap.copy();
   paintUserObjects(&p0);
@@ -1041,6 +1338,214 @@ void KRender::run()
     checkLoad();
 }
 
+QPair<int, int> KRender::getClassIdx(const KClass* cl) const
+{
+  for (int pack_idx = -1; auto pack: packs)
+  {
+    pack_idx++;
+    auto& classes = pack->getClasses();
+    auto  first   = classes.constData();
+    if (cl >= first && cl < first + classes.count())
+      return {pack_idx, int(cl - first)};
+  }
+  return {-1, -1};
+}
+
+const KClass* KRender::getClass(int pack_idx, int class_idx) const
+{
+  if (pack_idx < 0 || pack_idx >= packs.count())
+    return nullptr;
+  auto& classes = packs[pack_idx]->getClasses();
+  if (class_idx < 0 || class_idx >= classes.count())
+    return nullptr;
+  return classes.constData() + class_idx;
+}
+
+QByteArray KRender::saveLabels(const LabelSet& v) const
+{
+  using namespace KSerialize;
+  QByteArray ba;
+  write(ba, v.point_names.count());
+  for (auto& item: v.point_names)
+  {
+    auto cl_idx = getClassIdx(item.cl);
+    write(ba, cl_idx.first);
+    write(ba, cl_idx.second);
+    write(ba, item.rect);
+    write(ba, item.str_list);
+  }
+  write(ba, v.draw_text_array.count());
+  for (auto& dte: v.draw_text_array)
+  {
+    auto cl_idx = getClassIdx(dte.cl);
+    write(ba, cl_idx.first);
+    write(ba, cl_idx.second);
+    write(ba, dte.text);
+    write(ba, dte.rect);
+    write(ba, dte.actual_rect);
+    write(ba, int(dte.alignment));
+  }
+  write(ba, v.name_holder_array.count());
+  for (auto& nh: v.name_holder_array)
+  {
+    auto cl_idx = getClassIdx(nh.cl);
+    write(ba, cl_idx.first);
+    write(ba, cl_idx.second);
+    write(ba, nh.length_pix);
+    write(ba, nh.start_idx);
+    write(ba, nh.end_idx);
+    write(ba, nh.point_count);
+    write(ba, nh.angle_deg);
+    write(ba, nh.mid_point);
+    write(ba, nh.name);
+    write(ba, nh.tcolor.rgba());
+  }
+  return ba;
+}
+
+KRender::LabelSet KRender::loadLabels(const QByteArray& ba) const
+{
+  using namespace KSerialize;
+  LabelSet v;
+  if (ba.isEmpty())
+    return v;
+
+  int pos       = 0;
+  int count     = 0;
+  int pack_idx  = 0;
+  int class_idx = 0;
+  read(ba, pos, count);
+  for (int i = 0; i < count; i++)
+  {
+    PointName item;
+    read(ba, pos, pack_idx);
+    read(ba, pos, class_idx);
+    read(ba, pos, item.rect);
+    read(ba, pos, item.str_list);
+    item.cl        = getClass(pack_idx, class_idx);
+    item.class_idx = class_idx;
+    if (item.cl)
+      v.point_names.append(item);
+  }
+  read(ba, pos, count);
+  for (int i = 0; i < count; i++)
+  {
+    DrawTextEntry dte;
+    int           alignment = 0;
+    read(ba, pos, pack_idx);
+    read(ba, pos, class_idx);
+    read(ba, pos, dte.text);
+    read(ba, pos, dte.rect);
+    read(ba, pos, dte.actual_rect);
+    read(ba, pos, alignment);
+    dte.alignment = Qt::Alignment(alignment);
+    dte.cl        = getClass(pack_idx, class_idx);
+    dte.class_idx = class_idx;
+    if (dte.cl)
+      v.draw_text_array.append(dte);
+  }
+  read(ba, pos, count);
+  for (int i = 0; i < count; i++)
+  {
+    NameHolder nh;
+    QRgb       tcolor = 0;
+    read(ba, pos, pack_idx);
+    read(ba, pos, class_idx);
+    read(ba, pos, nh.length_pix);
+    read(ba, pos, nh.start_idx);
+    read(ba, pos, nh.end_idx);
+    read(ba, pos, nh.point_count);
+    read(ba, pos, nh.angle_deg);
+    read(ba, pos, nh.mid_point);
+    read(ba, pos, nh.name);
+    read(ba, pos, tcolor);
+    nh.tcolor    = QColor::fromRgba(tcolor);
+    nh.cl        = getClass(pack_idx, class_idx);
+    nh.class_idx = class_idx;
+    if (nh.cl)
+      v.name_holder_array.append(nh);
+  }
+  return v;
+}
+
+void KRender::LabelSet::append(const LabelSet& v)
+{
+  point_names += v.point_names;
+  draw_text_array += v.draw_text_array;
+  name_holder_array += v.name_holder_array;
+}
+
+void KRender::LabelSet::translate(QPoint shift, QRect keep_rect)
+{
+  QVector<PointName> new_point_names;
+  for (auto item: point_names)
+  {
+    item.rect.translate(shift);
+    if (item.rect.intersects(keep_rect))
+      new_point_names.append(item);
+  }
+  point_names = new_point_names;
+
+  QVector<DrawTextEntry> new_draw_text_array;
+  for (auto dte: draw_text_array)
+  {
+    dte.rect.translate(shift);
+    dte.actual_rect.translate(shift);
+    if (dte.rect.intersects(keep_rect))
+      new_draw_text_array.append(dte);
+  }
+  draw_text_array = new_draw_text_array;
+
+  QVector<NameHolder> new_name_holder_array;
+  for (auto nh: name_holder_array)
+  {
+    nh.mid_point += shift;
+    if (keep_rect.contains(nh.mid_point))
+      new_name_holder_array.append(nh);
+  }
+  name_holder_array = new_name_holder_array;
+}
+
+void KRender::LabelSet::sort()
+{
+  // classes listed earlier in the classifier win grid collisions,
+  // then higher layers
+  auto isBefore = [](int a_class_idx, const KClass* a_cl,
+                     int b_class_idx, const KClass* b_cl)
+  {
+    if (a_class_idx != b_class_idx)
+      return a_class_idx < b_class_idx;
+    return a_cl->layer > b_cl->layer;
+  };
+  std::stable_sort(point_names.begin(), point_names.end(),
+                   [&](const PointName& a, const PointName& b)
+                   {
+                     return isBefore(a.class_idx, a.cl, b.class_idx,
+                                     b.cl);
+                   });
+  std::stable_sort(draw_text_array.begin(), draw_text_array.end(),
+                   [&](const DrawTextEntry& a, const DrawTextEntry& b)
+                   {
+                     return isBefore(a.class_idx, a.cl, b.class_idx,
+                                     b.cl);
+                   });
+  std::stable_sort(
+      name_holder_array.begin(), name_holder_array.end(),
+      [&](const NameHolder& a, const NameHolder& b)
+      {
+        if (a.class_idx != b.class_idx || a.cl->layer != b.cl->layer)
+          return isBefore(a.class_idx, a.cl, b.class_idx, b.cl);
+        return a.length_pix > b.length_pix;
+      });
+}
+
+void KRender::LabelSet::clear()
+{
+  point_names.clear();
+  draw_text_array.clear();
+  name_holder_array.clear();
+}
+
 void KRender::renderUserObjects()
 {
   if (isRunning())
@@ -1062,11 +1567,57 @@ void KRender::render()
   if (isRunning())
     return;
   rendering_enabled = true;
-  if (QThreadPool::globalInstance()->activeThreadCount() == 0)
+  if (render_pool.activeThreadCount() == 0)
     checkUnload();
   QThread::start();
 }
 
+void KRender::removeDirtyTiles()
+{
+  QMutexLocker locker(&dirty_mutex);
+  auto         rects_m = dirty_rects_m;
+  dirty_rects_m.clear();
+  locker.unlock();
+  if (rects_m.isEmpty())
+    return;
+
+  tile_cache.remove(
+      [this, &rects_m](const KTileCache::Key& key)
+      {
+        double mip      = exp2(key.mip_key * 1e-6);
+        double margin_m = tile_margin_pix * std::max(1.0, mip);
+        QRectF tile_rect_m =
+            QRectF{QPointF(key.x, key.y) * tile_size_pix * mip,
+                   QSizeF(tile_size_pix, tile_size_pix) * mip}
+                .adjusted(-margin_m, -margin_m, margin_m, margin_m);
+        for (auto& rect_m: rects_m)
+          if (tile_rect_m.intersects(rect_m))
+            return true;
+        return false;
+      });
+}
+
+void KRender::onLoaded(QRectF rect_m)
+{
+  QMutexLocker locker(&dirty_mutex);
+  dirty_rects_m.append(rect_m);
+  locker.unlock();
+  if (isRunning())
+  {
+    has_pending_tiles = true;
+    return;
+  }
+  emit tileLoaded();
+}
+
+void KRender::onFinished()
+{
+  if (!has_pending_tiles)
+    return;
+  has_pending_tiles = false;
+  emit tileLoaded();
+}
+
 void KRender::stopAndWait()
 {
   rendering_enabled = false;
@@ -2,10 +2,17 @@
 #define KRENDER_H
 
 #include "krenderpack.h"
+#include "ktileloader.h"
+#include "ktilecache.h"
+#include "klabelgrid.h"
+#include "klabelcache.h"
+#include "kmemorymanager.h"
 #include <QReadWriteLock>
 #include <QThread>
+#include <QThreadPool>
 #include <QSet>
 #include <QMutex>
+#include <QPainterPath>
 
 class KRender: public QThread
 {
@@ -18,19 +25,22 @@ class KRender: public QThread
     QRect         rect;
     QRect         actual_rect;
     Qt::Alignment alignment;
+    int           class_idx = 0;
   };
 
   struct NameHolder
   {
+    const KClass*  cl          = nullptr;
+    int            class_idx   = 0;
     int            length_pix  = 0;
     int            start_idx   = 0;
     int            end_idx     = 0;
     int            point_count = 0;
     double         angle_deg   = 0;
     QPoint         mid_point;
-    const KObject* obj = nullptr;
+    QString        name;
     QColor         tcolor;
-    void           fix(const KPack* pack, const KObject* obj,
+    void           fix(const KClass* cl, QString name,
                        const QPoint& start, const QPoint& end);
   };
 
@@ -39,10 +49,63 @@ class KRender: public QThread
     QRect         rect;
     QStringList   str_list;
     const KClass* cl;
+    int           class_idx = 0;
+  };
+
+  struct LabelSet
+  {
+    QVector<PointName>     point_names;
+    QVector<DrawTextEntry> draw_text_array;
+    QVector<NameHolder>    name_holder_array;
+    void                   append(const LabelSet& v);
+    void                   translate(QPoint shift, QRect keep_rect);
+    void                   sort();
+    void                   clear();
+  };
+
+  struct RenderBin
+  {
+    QPoint                tile;
+    QRect                 rect;
+    bool                  is_cached = false;
+    QImage                image;
+    QVector<QVector<int>> object_idx_list;
+    LabelSet              labels;
+  };
+
+  struct ClassStyle
+  {
+    QPen   polygon_pen;
+    QBrush polygon_brush;
+    QPen   line_pen;
+    QPen   casing_pen;
+  };
+
+  struct PaintBatch
+  {
+    const ClassStyle* style = nullptr;
+    KClass::Type      type  = KClass::None;
+    QPainterPath      path;
+
+    PaintBatch();
   };
 
   Q_OBJECT
 
+  static constexpr int tile_size_pix       = 256;
+  static constexpr int tile_margin_pix     = 32;
+  static constexpr int label_cell_size_pix = 64;
+  static constexpr int label_halo_pix      = 2;
+
+  static constexpr int point_name_flags =
+      Qt::AlignLeft | Qt::AlignTop | Qt::TextWordWrap |
+      Qt::TextDontClip;
+
+  static thread_local QVector<QPointF>          pix_buffer;
+  static thread_local QVector<QPointF>          clip_buffer;
+  static thread_local QVector<QVector<QPointF>> clip_pieces;
+  static thread_local QPoint                    tile_origin_pix;
+
   double render_window_size_coef      = 0;
   QColor ocean_color                  = QColor(150, 210, 240);
   QColor land_color                   = QColor(250, 246, 230);
@@ -59,93 +122,170 @@ class KRender: public QThread
   bool          rendering_enabled      = false;
   bool          loading_enabled        = true;
   bool          getting_pixmap_enabled = false;
+  bool          has_pending_tiles      = false;
 
   QPointF               center_m;
   QSize                 pixmap_size   = {100, 100};
   double                pixel_size_mm = 0.1;
   KRenderPackCollection packs;
+  KTileLoader           loader;
+  QThreadPool           render_pool;
+  KTileCache            tile_cache;
+  KMemoryManager        memory_manager;
   QFont                 font;
 
-  QVector<PointName>     point_names[KRenderPack::render_count];
-  QVector<DrawTextEntry> draw_text_array[KRenderPack::render_count];
-  QVector<NameHolder>    name_holder_array[KRenderPack::render_count];
-  QVector<QRect>         text_rect_array;
-  QSizeF                 size_m;
-  QPointF                render_top_left_m;
-  QRectF                 render_frame_m;
-  QElapsedTimer          yield_timer;
+  QVector<QVector<ClassStyle>> class_styles;
+
+  QVector<KRenderPack*> render_packs;
+  QVector<RenderBin>    bins;
+  int                   bin_cols = 0;
+  QPoint                first_tile;
+  QPoint                frame_origin_pix;
+  int                   render_generation = 0;
+  qint64                render_stamp      = 0;
+  QAtomicInt            next_bin_idx;
+  QAtomicInt            data_generation;
+  QMutex                dirty_mutex;
+  QVector<QRectF>       dirty_rects_m;
+  LabelSet              labels;
+  KLabelGrid            label_grid;
+  KLabelGrid            point_grid;
+  KLabelCache           label_cache;
+  QSizeF                size_m;
+  QPointF               render_top_left_m;
+  QRectF                render_frame_m;
+  QElapsedTimer         yield_timer;
 
   void run();
   void start() = delete;
   void insertPack(int idx, QString path, bool load_now);
   void renderPack(QPainter* p, const KRenderPack* pack,
-                  int render_idx, int line_iter);
-  void render(QPainter* p, QVector<KRenderPack*> render_packs,
-              int render_idx);
+                  const QVector<ClassStyle>& styles,
+                  const QVector<int>&        object_idx_list,
+                  int bin_idx, int line_iter);
+  void paintBatch(QPainter* p, PaintBatch& batch, int line_iter);
 
-  bool checkMipRange(const KPack* pack, const KObject* obj);
+  static ClassStyle   createClassStyle(const KClass& cl);
+  static Qt::PenStyle getPenStyle(const KClass& cl);
+  static double       getCasingCoef(int w);
+  static qint64       getSignedArea(const QPolygon& pl);
+
+  void            createBins();
+  void            binObjects();
+  void            renderBins();
+  void            renderBin(int bin_idx);
+  QPoint          getTile(QPointF m) const;
+  KTileCache::Key getTileKey(QPoint tile) const;
+  QRectF          getTileRectM(QPoint tile) const;
+  double          getTileMarginM() const;
+  QByteArray      saveLabels(const LabelSet& v) const;
+  LabelSet        loadLabels(const QByteArray& ba) const;
+  const KClass*   getClass(int pack_idx, int class_idx) const;
+  QPair<int, int> getClassIdx(const KClass* cl) const;
+
+  bool checkMipRange(const KRenderPack*        pack,
+                     const KTileStore::Object* obj);
   bool canContinue();
   void checkYieldResult();
 
   bool paintObject(QPainter* p, const KRenderPack* map,
-                   const KObject& obj, int render_idx, int line_iter);
+                   const KRenderPack::RenderObject& ro,
+                   int bin_idx, int line_iter, PaintBatch& batch);
   bool paintPointNames(QPainter* p);
   bool paintLineNames(QPainter* p);
   bool paintPolygonNames(QPainter* p);
 
-  bool isCluttering(const QRect&);
-  void paintOutlinedText(QPainter* p, const DrawTextEntry& dte);
-  void addDrawTextEntry(QVector<DrawTextEntry>& draw_text_array,
-                        DrawTextEntry           new_dte);
+  QSize               getPointNameSize() const;
+  KLabelCache::Sprite getLabelSprite(const QFont&   font,
+                                     const QString& text,
+                                     const QColor&  tcolor,
+                                     double         angle_deg,
+                                     QSize          wrap_size,
+                                     int            flags);
+
+  static void paintOutlinedText(QPainter* p, QRect rect, int flags,
+                                const QString& text,
+                                const QColor&  tcolor);
 
-  QPolygon poly2pix(const KGeoPolygon& polygon);
+  QRectF            getClipRect() const;
+  void              projectPolygon(const KTileStore& store,
+                                   int               polygon_idx,
+                                   QVector<QPointF>& pix);
+  QVector<QPolygon> line2pix(const KTileStore& store,
+                             int               polygon_idx);
+  static QPolygon   toPolygon(const QVector<QPointF>& pix);
+
+  QPoint   meters2renderPix(QPointF m) const;
+  QPoint   meters2tilePix(QPointF m) const;
+  bool     isInTile(QPoint pix) const;
+  QPolygon poly2pix(const KTileStore& store, int polygon_idx);
   void     paintPointObject(QPainter* p, const KRenderPack& pack,
-                            const KObject& obj, int render_idx);
+                            const KTileStore&         store,
+                            const KTileStore::Object& obj,
+                            int                       bin_idx);
   void     paintPolygonObject(QPainter* p, const KRenderPack& pack,
-                              const KObject& obj, int render_idx);
+                              const KTileStore&         store,
+                              const KTileStore::Object& obj,
+                              int bin_idx, PaintBatch& batch);
   void     paintLineObject(QPainter* painter, const KRenderPack& pack,
-                           const KObject& obj, int render_idx,
-                           int line_iter);
+                           const KTileStore&         store,
+                           const KTileStore::Object& obj,
+                           int bin_idx, int line_iter,
+                           PaintBatch& batch);
   QRectF   getDrawRectM() const;
   bool     needToLoadPack(const KRenderPack* pack,
                           const QRectF&      draw_rect);
+  void     requestTiles(KRenderPack* pack, const QRectF& rect_m,
+                        double req_mip, bool is_prefetch);
   void     checkLoad();
   void     checkUnload();
-  void     onLoaded();
+  void     removeDirtyTiles();
+  void     onLoaded(QRectF rect_m);
+  void     onFinished();
 
 signals:
   void started(QRectF);
   void paintUserObjects(QPainter* p);
   void rendered(int ms_elapsed);
+  void tileLoaded();
 
 public:
+  KRender();
   virtual ~KRender();
-  void           addPack(QString path, bool load_now);
-  void           setMip(double);
-  double         getMip() const;
-  void           setCenterM(QPointF);
-  QPointF        getCenterM() const;
-  QPointF        getRenderCenterM() const;
-  void           setPixmapSize(QSize);
-  void           setPixelSizeMM(double);
-  void           setUpdateIntervalMs(int ms);
-  void           setBackgroundColor(QColor);
-  double         getRenderWindowSizeCoef() const;
-  void           setRenderWindowSizeCoef(double);
-  void           setMaxLoadedMapsCount(int);
-  void           paintPointName(QPainter* p, const QString& text,
-                                const QColor& tcolor);
-  static void    paintOutlinedText(QPainter* p, const QString& text,
-                                   const QColor& tcolor);
-  const QPixmap* getPixmap() const;
-  const KPack*   getWorldPack() const;
-  void           render();
-  void           renderUserObjects();
-  void           stopAndWait();
-  void           enableLoading(bool);
+  void               addPack(QString path, bool load_now);
+  void               setMip(double);
+  double             getMip() const;
+  void               setCenterM(QPointF);
+  QPointF            getCenterM() const;
+  QPointF            getRenderCenterM() const;
+  void               setPixmapSize(QSize);
+  void               setPixelSizeMM(double);
+  void               setUpdateIntervalMs(int ms);
+  void               setBackgroundColor(QColor);
+  double             getRenderWindowSizeCoef() const;
+  void               setRenderWindowSizeCoef(double);
+  void               setMaxLoadedMapsCount(int);
+  void               setTileCacheSize(qint64 bytes);
+  void               setTileCacheDir(QString path, qint64 max_size);
+  void               setMapMemorySize(qint64 bytes);
+  void               paintPointName(QPainter* p, const QString& text,
+                                    const QColor& tcolor);
+  static void        paintOutlinedText(QPainter*      p,
+                                       const QString& text,
+                                       const QColor&  tcolor);
+  const QPixmap*     getPixmap() const;
+  const KRenderPack* getWorldPack() const;
+  void               render();
+  void               renderUserObjects();
+  void               stopAndWait();
+  void               enableLoading(bool);
+  void               prefetch(QPointF shift_pix, double zoom_coef);
+  void               cancelPrefetch();
 
   QPoint deg2pix(KGeoCoor) const;
 
+  KMemoryManager::Usage getMapMemoryUsage() const;
+
   QPoint  meters2pix(QPointF m) const;
   QPointF pix2meters(QPointF pix) const;
 
@@ -1,5 +1,5 @@
 #include "krenderpack.h"
-#include "klocker.h"
+#include <QDateTime>
 #include <QDebug>
 
 KRenderPack::KRenderPack(const QString& _path)
@@ -17,71 +17,218 @@ bool KRenderPack::intersects(QPolygonF polygon_m) const
   return false;
 }
 
-void KRenderPack::clear()
+std::shared_ptr<const KRenderPack::Snapshot>
+KRenderPack::getSnapshot() const
 {
-  KLocker big_locker(&main_lock, KLocker::Write);
-  if (!big_locker.hasLocked())
-    return;
-  KLocker small_locker(&tile_lock, KLocker::Write);
-  if (!small_locker.hasLocked())
+  return std::atomic_load(&snapshot);
+}
+
+void KRenderPack::publish(std::shared_ptr<const Snapshot> v)
+{
+  std::atomic_store(&snapshot, v);
+}
+
+bool KRenderPack::clear()
+{
+  QMutexLocker snapshot_locker(&snapshot_mutex);
+  if (!getSnapshot())
+    return false;
+  publish(nullptr);
+  main_last_used = 0;
+  tile_last_used.clear();
+  releaseVisibleObjects();
+  return true;
+}
+
+bool KRenderPack::unloadTile(int tile_idx)
+{
+  QMutexLocker snapshot_locker(&snapshot_mutex);
+  auto         current = getSnapshot();
+  if (!current || !current->tile_stores.value(tile_idx))
+    return false;
+  auto s = std::make_shared<Snapshot>(*current);
+  s->tile_stores[tile_idx].reset();
+  publish(s);
+  return true;
+}
+
+const QVector<KClass>& KRenderPack::getClasses() const
+{
+  if (!render_snapshot)
+    return classes;
+  return render_snapshot->pack->classes;
+}
+
+qint64 KRenderPack::getMemorySize() const
+{
+  auto s = getSnapshot();
+  if (!s)
+    return 0;
+  qint64 size = s->main_store->getMemorySize();
+  for (auto& store: s->tile_stores)
+    if (store)
+      size += store->getMemorySize();
+  return size;
+}
+
+void KRenderPack::markUsed(const QRectF& rect_m, qint64 stamp)
+{
+  QMutexLocker snapshot_locker(&snapshot_mutex);
+  auto         s = getSnapshot();
+  if (!s)
     return;
-  KPack::clear();
-  for (int i = 0; i < max_layer_count; i++)
-    render_data[i].clear();
-  render_object_count = 0;
-  render_start_list.clear();
+  main_last_used = stamp;
+  for (int tile_idx = -1; auto& store: s->tile_stores)
+  {
+    tile_idx++;
+    if (store && s->pack->getTileRectM(tile_idx).intersects(rect_m))
+      tile_last_used[tile_idx] = stamp;
+  }
+}
+
+qint64 KRenderPack::getLastUsed(int tile_idx) const
+{
+  QMutexLocker snapshot_locker(&snapshot_mutex);
+  if (tile_idx < 0)
+    return main_last_used;
+  return tile_last_used.value(tile_idx);
 }
 
-void KRenderPack::loadMain(bool load_objects, double pixel_size_mm)
+bool KRenderPack::loadMain(bool load_objects, double pixel_size_mm)
 {
-  KPack::loadMain(path, load_objects, pixel_size_mm);
-  if (load_objects)
+  if (!load_objects)
   {
-    QWriteLocker big_locker(&main_lock);
-    addCollectionToIndex(main);
-    main.status = KTile::Loaded;
+    KPack::loadMain(path, false, pixel_size_mm);
+    return false;
   }
+  if (getSnapshot())
+    return false;
+
+  auto pack = std::make_shared<KPack>();
+  pack->loadMain(path, true, pixel_size_mm);
+  if (pack->main.status != KTile::Loading)
+    return false;
+
+  KTileStore store;
+  for (auto& obj: pack->main)
+    store.append(obj);
+  store.project();
+  store.buildIndex();
+  store.squeeze();
+  pack->main.clear();
+  pack->main.status = KTile::Loaded;
+
+  QVector<QRectF> tile_rects_m;
+  for (int tile_idx = -1; auto& tile: pack->tiles)
+  {
+    tile_idx++;
+    if (tile.object_count > 0)
+      tile_rects_m.append(pack->getTileRectM(tile_idx));
+    else
+      tile_rects_m.append(QRectF());
+  }
+  auto rtree = std::make_shared<KRTree>();
+  rtree->build(tile_rects_m);
+
+  auto s        = std::make_shared<Snapshot>();
+  s->pack       = pack;
+  s->tile_rtree = rtree;
+  s->main_store = std::make_shared<KTileStore>(std::move(store));
+  s->tile_stores.resize(pack->tiles.count());
+
+  QMutexLocker snapshot_locker(&snapshot_mutex);
+  tile_last_used.fill(0, pack->tiles.count());
+  main_last_used = QDateTime::currentMSecsSinceEpoch();
+  publish(s);
+  return true;
 }
 
-void KRenderPack::loadTile(int tile_idx)
+bool KRenderPack::loadTile(int tile_idx)
 {
-  KPack::loadTile(path, tile_idx);
-  QWriteLocker small_locker(&tile_lock);
-  addCollectionToIndex(tiles[tile_idx]);
-  tiles[tile_idx].status = KTile::Loaded;
+  auto current = getSnapshot();
+  if (!current || tile_idx < 0 ||
+      tile_idx > current->tile_stores.count() - 1)
+    return false;
+  if (current->tile_stores.at(tile_idx))
+    return false;
+
+  auto             pack = current->pack;
+  QVector<KObject> objects;
+  if (!pack->readTile(tile_idx, objects))
+  {
+    qDebug() << "ERROR: corrupted tile" << tile_idx << "in" << path;
+    return false;
+  }
+
+  KTileStore store;
+  for (auto& obj: objects)
+    store.append(obj);
+  store.project();
+  store.buildIndex();
+  store.squeeze();
+  objects.clear();
+  auto tile_store = std::make_shared<KTileStore>(std::move(store));
+
+  QMutexLocker snapshot_locker(&snapshot_mutex);
+  current = getSnapshot();
+  if (!current || current->pack != pack)
+    return false;
+  auto s                   = std::make_shared<Snapshot>(*current);
+  s->tile_stores[tile_idx] = tile_store;
+  publish(s);
+  tile_last_used[tile_idx] = QDateTime::currentMSecsSinceEpoch();
+  return true;
 }
 
-void KRenderPack::addCollectionToIndex(KTile& collection)
+void KRenderPack::addVisibleObjects(const KTileStore&      store,
+                                    const QVector<QRectF>& rects_m,
+                                    QVector<RenderObject>* layers)
 {
-  for (auto& obj: collection)
+  QVector<int> found;
+  for (auto& rect_m: rects_m)
+    visited_count += store.rtree.search(rect_m, found);
+  std::sort(found.begin(), found.end());
+  found.erase(std::unique(found.begin(), found.end()), found.end());
+  for (auto obj_idx: found)
   {
-    auto cl = classes[obj.class_idx];
-    render_data[cl.layer].append(&obj);
+    auto& obj = store.objects[obj_idx];
+    auto& cl  = render_snapshot->pack->classes[obj.class_idx];
+    layers[cl.layer].append({&store, &obj});
   }
+}
 
-  int total_object_count = 0;
-  for (auto layer: render_data)
-    total_object_count += layer.count();
+void KRenderPack::releaseVisibleObjects()
+{
+  visible_objects.clear();
+  render_snapshot.reset();
+}
 
-  render_object_count = total_object_count / render_count;
+void KRenderPack::pinSnapshot()
+{
+  releaseVisibleObjects();
+  render_snapshot = getSnapshot();
+}
+
+void KRenderPack::updateVisibleObjects(const QVector<QRectF>& rects_m)
+{
+  visible_objects.clear();
+  visited_count = 0;
+  if (!render_snapshot)
+    return;
 
-  int curr_obj_count = 0;
-  render_start_list.clear();
-  render_start_list += {0, 0};
-  for (int layer_idx = -1; auto layer: render_data)
+  QVector<RenderObject> layers[max_layer_count];
+  addVisibleObjects(*render_snapshot->main_store, rects_m, layers);
+  for (auto& store: render_snapshot->tile_stores)
+    if (store)
+      addVisibleObjects(*store, rects_m, layers);
+  for (auto& layer: layers)
   {
-    layer_idx++;
-    for (int object_idx = -1; auto obj: layer)
-    {
-      object_idx++;
-      Q_UNUSED(obj)
-      curr_obj_count++;
-      if (curr_obj_count >= render_object_count)
-      {
-        render_start_list += {layer_idx, object_idx};
-        curr_obj_count = 0;
-      }
-    }
+    std::stable_sort(layer.begin(), layer.end(),
+                     [](const RenderObject& a, const RenderObject& b)
+                     {
+                       return a.obj->class_idx < b.obj->class_idx;
+                     });
+    visible_objects += layer;
   }
 }
 
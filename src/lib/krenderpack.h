@@ -2,34 +2,62 @@
 #define KRENDERPACK_H
 
 #include "kpack.h"
+#include "ktilestore.h"
+#include "krtree.h"
+#include <QMutex>
+#include <memory>
 
 class KRenderPack: public KPack
 {
-  struct RenderAddress
+public:
+  static constexpr int max_layer_count = 24;
+
+  struct RenderObject
   {
-    int layer_idx;
-    int obj_idx;
+    const KTileStore*         store;
+    const KTileStore::Object* obj;
   };
 
-public:
-  static constexpr int max_layer_count = 24;
-  static constexpr int render_count    = 4;
+  struct Snapshot
+  {
+    std::shared_ptr<const KPack>               pack;
+    std::shared_ptr<const KRTree>              tile_rtree;
+    std::shared_ptr<const KTileStore>          main_store;
+    QVector<std::shared_ptr<const KTileStore>> tile_stores;
+  };
 
-  QVector<KObject*>    render_data[max_layer_count];
-  QReadWriteLock       main_lock;
-  QReadWriteLock       tile_lock;
-  QList<RenderAddress> render_start_list;
-  int                  render_object_count;
-  QString              path;
+  QVector<RenderObject> visible_objects;
+  int                   visited_count = 0;
+  QString               path;
 
-  void addCollectionToIndex(KTile& collection);
+private:
+  std::shared_ptr<const Snapshot> snapshot;
+  std::shared_ptr<const Snapshot> render_snapshot;
+  mutable QMutex                  snapshot_mutex;
+  qint64                          main_last_used = 0;
+  QVector<qint64>                 tile_last_used;
+
+  void publish(std::shared_ptr<const Snapshot>);
+  void addVisibleObjects(const KTileStore&      store,
+                         const QVector<QRectF>& rects_m,
+                         QVector<RenderObject>* layers);
 
 public:
   KRenderPack(const QString& path);
-  void clear();
-  void loadMain(bool load_objects, double pixel_size_mm);
-  void loadTile(int tile_idx);
-  bool intersects(QPolygonF polygon) const;
+  bool   clear();
+  bool   loadMain(bool load_objects, double pixel_size_mm);
+  bool   loadTile(int tile_idx);
+  bool   unloadTile(int tile_idx);
+  bool   intersects(QPolygonF polygon) const;
+  void   pinSnapshot();
+  void   updateVisibleObjects(const QVector<QRectF>& rects_m);
+  void   releaseVisibleObjects();
+  void   markUsed(const QRectF& rect_m, qint64 stamp);
+  qint64 getLastUsed(int tile_idx) const;
+  qint64 getMemorySize() const;
+
+  const QVector<KClass>&          getClasses() const;
+  std::shared_ptr<const Snapshot> getSnapshot() const;
 };
 
 struct KRenderPackCollection: public QVector<KRenderPack*>
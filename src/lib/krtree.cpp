@@ -0,0 +1,149 @@
+#include <math.h>
+#include "krtree.h"
+
+namespace
+{
+QRectF unite(const QRectF& r1, const QRectF& r2)
+{
+  return {QPointF{std::min(r1.left(), r2.left()),
+                  std::min(r1.top(), r2.top())},
+          QPointF{std::max(r1.right(), r2.right()),
+                  std::max(r1.bottom(), r2.bottom())}};
+}
+
+void sortTileRecursive(QVector<int>&          idx_list,
+                       const QVector<QRectF>& rects,
+                       QVector<KRTree::Node>& level)
+{
+  int count       = idx_list.count();
+  int node_count  = std::ceil(1.0 * count / KRTree::node_size);
+  int slice_count = std::ceil(sqrt(node_count));
+  int slice_size  = slice_count * KRTree::node_size;
+
+  std::sort(idx_list.begin(), idx_list.end(),
+            [&](int a, int b)
+            {
+              return rects[a].center().x() < rects[b].center().x();
+            });
+  for (int slice_start = 0; slice_start < count;
+       slice_start += slice_size)
+  {
+    auto begin = idx_list.begin() + slice_start;
+    auto end =
+        idx_list.begin() + std::min(count, slice_start + slice_size);
+    std::sort(begin, end,
+              [&](int a, int b)
+              {
+                return rects[a].center().y() < rects[b].center().y();
+              });
+  }
+
+  for (int start = 0; start < count; start += KRTree::node_size)
+  {
+    KRTree::Node node;
+    node.first = start;
+    node.count = std::min(KRTree::node_size, count - start);
+    node.rect  = rects[idx_list[start]];
+    for (int i = start + 1; i < start + node.count; i++)
+      node.rect = unite(node.rect, rects[idx_list[i]]);
+    level.append(node);
+  }
+}
+}
+
+bool KRTree::overlaps(const QRectF& r1, const QRectF& r2)
+{
+  return r1.left() <= r2.right() && r2.left() <= r1.right() &&
+         r1.top() <= r2.bottom() && r2.top() <= r1.bottom();
+}
+
+void KRTree::clear()
+{
+  nodes.clear();
+  items.clear();
+  item_rects.clear();
+  leaf_count = 0;
+}
+
+void KRTree::build(const QVector<QRectF>& rects)
+{
+  clear();
+  if (rects.isEmpty())
+    return;
+
+  items.resize(rects.count());
+  for (int i = 0; i < items.count(); i++)
+    items[i] = i;
+  QVector<Node> level;
+  sortTileRecursive(items, rects, level);
+  nodes      = level;
+  leaf_count = level.count();
+  for (auto idx: items)
+    item_rects.append(rects[idx]);
+
+  int level_start = 0;
+  while (level.count() > 1)
+  {
+    QVector<QRectF> level_rects;
+    for (auto& node: level)
+      level_rects.append(node.rect);
+    QVector<int> idx_list(level.count());
+    for (int i = 0; i < idx_list.count(); i++)
+      idx_list[i] = i;
+
+    QVector<Node> upper_level;
+    sortTileRecursive(idx_list, level_rects, upper_level);
+
+    QVector<Node> sorted_level;
+    for (auto idx: idx_list)
+      sorted_level.append(level[idx]);
+    for (int i = 0; i < sorted_level.count(); i++)
+      nodes[level_start + i] = sorted_level[i];
+    for (auto& node: upper_level)
+      node.first += level_start;
+
+    level_start = nodes.count();
+    nodes.append(upper_level);
+    level = upper_level;
+  }
+  nodes.squeeze();
+  items.squeeze();
+  item_rects.squeeze();
+}
+
+int KRTree::search(const QRectF& rect, QVector<int>& result) const
+{
+  if (nodes.isEmpty())
+    return 0;
+
+  int visited_count = 0;
+  int stack[256];
+  int stack_size      = 0;
+  stack[stack_size++] = nodes.count() - 1;
+  while (stack_size > 0)
+  {
+    int   node_idx = stack[--stack_size];
+    auto& node     = nodes[node_idx];
+    visited_count++;
+    if (!overlaps(node.rect, rect))
+      continue;
+    if (node_idx < leaf_count)
+    {
+      for (int i = node.first; i < node.first + node.count; i++)
+        if (overlaps(item_rects[i], rect))
+          result.append(items[i]);
+      visited_count += node.count;
+    }
+    else
+      for (int i = node.first; i < node.first + node.count; i++)
+        stack[stack_size++] = i;
+  }
+  return visited_count;
+}
+
+qint64 KRTree::getMemorySize() const
+{
+  return nodes.capacity() * sizeof(Node) +
+         items.capacity() * sizeof(int) +
+         item_rects.capacity() * sizeof(QRectF);
+}
@@ -0,0 +1,31 @@
+#ifndef KRTREE_H
+#define KRTREE_H
+
+#include <QRectF>
+#include <QVector>
+
+struct KRTree
+{
+  static constexpr int node_size = 16;
+
+  struct Node
+  {
+    QRectF rect;
+    int    first = 0;
+    int    count = 0;
+  };
+
+  QVector<Node>   nodes;
+  QVector<int>    items;
+  QVector<QRectF> item_rects;
+  int             leaf_count = 0;
+
+  void   build(const QVector<QRectF>& rects);
+  int    search(const QRectF& rect, QVector<int>& result) const;
+  void   clear();
+  qint64 getMemorySize() const;
+
+  static bool overlaps(const QRectF& r1, const QRectF& r2);
+};
+
+#endif  // KRTREE_H
@@ -123,6 +123,22 @@ inline void read(QFile* f, QImage& image)
     image.load(f, "PNG");
 }
 
+template<class T>
+inline void read(const uchar* data, qint64& pos, T& v)
+{
+  memcpy(&v, &data[pos], sizeof(v));
+  pos += sizeof(v);
+}
+
+template<class T>
+inline bool read(const uchar* data, qint64 size, qint64& pos, T& v)
+{
+  if (pos < 0 || pos > size - qint64(sizeof(v)))
+    return false;
+  read(data, pos, v);
+  return true;
+}
+
 template<class T>
 inline void write(QByteArray& ba, const T& v)
 {
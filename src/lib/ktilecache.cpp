@@ -0,0 +1,225 @@
+#include "ktilecache.h"
+#include "kserialize.h"
+#include <QDir>
+#include <QDebug>
+
+bool KTileCache::Key::operator==(const Key& v) const
+{
+  return mip_key == v.mip_key && x == v.x && y == v.y &&
+         generation == v.generation;
+}
+
+QString KTileCache::Key::getFileName() const
+{
+  return QString("%1_%2_%3_%4.ktile")
+      .arg(mip_key)
+      .arg(x)
+      .arg(y)
+      .arg(generation);
+}
+
+uint qHash(const KTileCache::Key& key, uint seed)
+{
+  return qHash(key.mip_key, seed) ^ qHash(key.x, seed) * 31 ^
+         qHash(key.y, seed) * 131 ^ qHash(key.generation, seed);
+}
+
+qint64 KTileCache::Tile::getSize() const
+{
+  return image.sizeInBytes() + labels.count();
+}
+
+KTileCache::~KTileCache()
+{
+  for (auto key: spilled_keys)
+    QFile::remove(spill_dir + "/" + key.getFileName());
+}
+
+void KTileCache::setMaxSize(qint64 bytes)
+{
+  max_size = bytes;
+  evict();
+}
+
+void KTileCache::setSpillDir(QString path, qint64 _max_spill_size)
+{
+  QDir dir(path);
+  if (!dir.exists() && !dir.mkpath("."))
+  {
+    qDebug() << "ERROR: unable to create" << path;
+    return;
+  }
+  for (auto& fi: dir.entryInfoList({"*.ktile"}, QDir::Files))
+    QFile::remove(fi.absoluteFilePath());
+  spill_dir      = path;
+  max_spill_size = _max_spill_size;
+}
+
+void KTileCache::setTileSize(QSize v)
+{
+  tile_size = v;
+}
+
+qint64 KTileCache::getSize() const
+{
+  return size;
+}
+
+void KTileCache::remove(std::function<bool(const Key&)> pred)
+{
+  for (auto it = items.begin(); it != items.end();)
+  {
+    if (!pred(it->key))
+    {
+      it++;
+      continue;
+    }
+    size -= it->tile.getSize();
+    item_map.remove(it->key);
+    it = items.erase(it);
+  }
+  auto keys = spilled_keys;
+  for (auto key: keys)
+    if (pred(key))
+      removeSpilled(key);
+}
+
+void KTileCache::clear()
+{
+  items.clear();
+  item_map.clear();
+  size = 0;
+  for (auto key: spilled_keys)
+    QFile::remove(spill_dir + "/" + key.getFileName());
+  spilled_keys.clear();
+  spilled_sizes.clear();
+  spill_size = 0;
+}
+
+bool KTileCache::find(const Key& key, Tile& tile)
+{
+  auto it = item_map.find(key);
+  if (it != item_map.end())
+  {
+    items.splice(items.begin(), items, it.value());
+    tile = items.front().tile;
+    return true;
+  }
+  if (!unspill(key, tile))
+    return false;
+  insert(key, tile);
+  return true;
+}
+
+void KTileCache::insert(const Key& key, const Tile& tile)
+{
+  if (auto it = item_map.find(key); it != item_map.end())
+  {
+    size -= it.value()->tile.getSize();
+    items.erase(it.value());
+    item_map.erase(it);
+  }
+  items.push_front({key, tile});
+  item_map.insert(key, items.begin());
+  size += tile.getSize();
+  evict();
+}
+
+void KTileCache::evict()
+{
+  while (size > max_size && !items.empty())
+  {
+    auto& item = items.back();
+    if (!spill_dir.isEmpty())
+      spill(item);
+    size -= item.tile.getSize();
+    item_map.remove(item.key);
+    items.pop_back();
+  }
+}
+
+void KTileCache::spill(const Item& item)
+{
+  using namespace KSerialize;
+  if (spilled_sizes.contains(item.key))
+    return;
+
+  auto  path  = spill_dir + "/" + item.key.getFileName();
+  auto& image = item.tile.image;
+  QFile f(path);
+  if (!f.open(QIODevice::WriteOnly))
+  {
+    qDebug() << "ERROR: unable to write to" << path;
+    return;
+  }
+  write(&f, image.width());
+  write(&f, image.height());
+  write(&f, (int)image.format());
+  f.write((const char*)image.constBits(), image.sizeInBytes());
+  write(&f, item.tile.labels.count());
+  f.write(item.tile.labels);
+  f.close();
+
+  spilled_keys.append(item.key);
+  spilled_sizes.insert(item.key, f.size());
+  spill_size += f.size();
+  while (spill_size > max_spill_size && !spilled_keys.isEmpty())
+    removeSpilled(spilled_keys.first());
+}
+
+bool KTileCache::unspill(const Key& key, Tile& tile)
+{
+  using namespace KSerialize;
+  if (!spilled_sizes.contains(key))
+    return false;
+
+  QFile f(spill_dir + "/" + key.getFileName());
+  if (!f.open(QIODevice::ReadOnly))
+  {
+    removeSpilled(key);
+    return false;
+  }
+  int w = 0, h = 0, format = QImage::Format_Invalid;
+  read(&f, w);
+  read(&f, h);
+  read(&f, format);
+  bool is_valid = QSize(w, h) == tile_size &&
+                  format > QImage::Format_Invalid &&
+                  format < QImage::NImageFormats;
+  if (is_valid)
+  {
+    tile.image = QImage(w, h, (QImage::Format)format);
+    is_valid   = !tile.image.isNull() &&
+               f.read((char*)tile.image.bits(),
+                      tile.image.sizeInBytes()) ==
+                   tile.image.sizeInBytes();
+  }
+  int labels_size = -1;
+  if (is_valid)
+  {
+    read(&f, labels_size);
+    is_valid = labels_size >= 0 &&
+               labels_size <= f.size() - f.pos();
+  }
+  if (is_valid)
+  {
+    tile.labels = f.read(labels_size);
+    is_valid    = tile.labels.count() == labels_size;
+  }
+  f.close();
+  removeSpilled(key);
+  if (!is_valid)
+  {
+    qDebug() << "ERROR: corrupted spill file for tile" << key.x
+             << key.y;
+    tile = Tile();
+  }
+  return is_valid;
+}
+
+void KTileCache::removeSpilled(const Key& key)
+{
+  QFile::remove(spill_dir + "/" + key.getFileName());
+  spill_size -= spilled_sizes.take(key);
+  spilled_keys.removeOne(key);
+}
@@ -0,0 +1,66 @@
+#ifndef KTILECACHE_H
+#define KTILECACHE_H
+
+#include <QImage>
+#include <QHash>
+#include <list>
+#include <functional>
+
+class KTileCache
+{
+public:
+  struct Key
+  {
+    qint64  mip_key    = 0;
+    int     x          = 0;
+    int     y          = 0;
+    int     generation = 0;
+    bool    operator==(const Key&) const;
+    QString getFileName() const;
+  };
+
+  struct Tile
+  {
+    QImage     image;
+    QByteArray labels;
+    qint64     getSize() const;
+  };
+
+private:
+  struct Item
+  {
+    Key  key;
+    Tile tile;
+  };
+
+  qint64                                max_size       = 128 << 20;
+  qint64                                max_spill_size = 512 << 20;
+  qint64                                size           = 0;
+  qint64                                spill_size     = 0;
+  QSize                                 tile_size;
+  QString                               spill_dir;
+  std::list<Item>                       items;
+  QHash<Key, std::list<Item>::iterator> item_map;
+  QList<Key>                            spilled_keys;
+  QHash<Key, qint64>                    spilled_sizes;
+
+  void evict();
+  void spill(const Item& item);
+  bool unspill(const Key& key, Tile& tile);
+  void removeSpilled(const Key& key);
+
+public:
+  virtual ~KTileCache();
+  void   setMaxSize(qint64 bytes);
+  void   setSpillDir(QString path, qint64 max_spill_size);
+  void   setTileSize(QSize);
+  bool   find(const Key& key, Tile& tile);
+  void   insert(const Key& key, const Tile& tile);
+  void   remove(std::function<bool(const Key&)> pred);
+  void   clear();
+  qint64 getSize() const;
+};
+
+uint qHash(const KTileCache::Key& key, uint seed = 0);
+
+#endif  // KTILECACHE_H
@@ -0,0 +1,122 @@
+#include "ktileloader.h"
+#include <QDebug>
+
+bool KTileLoader::Request::operator==(const Request& r) const
+{
+  return pack == r.pack && tile_idx == r.tile_idx;
+}
+
+KTileLoader::KTileLoader()
+{
+  setWorkerCount(std::clamp(QThread::idealThreadCount() / 2, 1, 4));
+}
+
+KTileLoader::~KTileLoader()
+{
+  clear();
+  pool.waitForDone();
+}
+
+void KTileLoader::setMaxQueueSize(int v)
+{
+  max_queue_size = v;
+}
+
+void KTileLoader::setWorkerCount(int v)
+{
+  pool.setMaxThreadCount(v);
+}
+
+int KTileLoader::getPendingCount()
+{
+  QMutexLocker locker(&mutex);
+  return queue.count() + active.count();
+}
+
+void KTileLoader::clear()
+{
+  QMutexLocker locker(&mutex);
+  queue.clear();
+}
+
+void KTileLoader::cancelPrefetch()
+{
+  QMutexLocker locker(&mutex);
+  queue.erase(std::remove_if(queue.begin(), queue.end(),
+                             [](const Request& r)
+                             {
+                               return r.is_prefetch;
+                             }),
+              queue.end());
+}
+
+int KTileLoader::getFirstPrefetchIdx() const
+{
+  for (int i = -1; auto& r: queue)
+  {
+    i++;
+    if (r.is_prefetch)
+      return i;
+  }
+  return queue.count();
+}
+
+bool KTileLoader::request(Request r)
+{
+  QMutexLocker locker(&mutex);
+  if (active.contains(r))
+    return true;
+  int queue_idx = queue.indexOf(r);
+  if (queue_idx >= 0)
+  {
+    if (r.is_prefetch || !queue[queue_idx].is_prefetch)
+      return true;
+    queue.removeAt(queue_idx);
+    queue.insert(getFirstPrefetchIdx(), r);
+    return true;
+  }
+  if (queue.count() >= max_queue_size)
+  {
+    if (r.is_prefetch || !queue.last().is_prefetch)
+      return false;
+    queue.removeLast();
+  }
+  if (r.is_prefetch)
+    queue.append(r);
+  else
+    queue.insert(getFirstPrefetchIdx(), r);
+  pool.start(
+      [this]
+      {
+        processNext();
+      });
+  return true;
+}
+
+void KTileLoader::processNext()
+{
+  QMutexLocker locker(&mutex);
+  if (queue.isEmpty())
+    return;
+  auto r = queue.takeFirst();
+  active.append(r);
+  locker.unlock();
+
+  bool is_loaded = false;
+  if (r.tile_idx == main_tile_idx)
+    is_loaded = r.pack->loadMain(true, r.pixel_size_mm);
+  else
+    is_loaded = r.pack->loadTile(r.tile_idx);
+
+  locker.relock();
+  active.removeOne(r);
+  locker.unlock();
+
+  if (!is_loaded)
+    return;
+  auto rect_m = r.pack->frame.toRectM().normalized();
+  auto s      = r.pack->getSnapshot();
+  if (r.tile_idx != main_tile_idx && s)
+    rect_m = s->pack->getTileRectM(r.tile_idx);
+  emit loaded(rect_m);
+}
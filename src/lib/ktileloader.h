@@ -0,0 +1,48 @@
+#ifndef KTILELOADER_H
+#define KTILELOADER_H
+
+#include "krenderpack.h"
+#include <QThreadPool>
+#include <QMutex>
+
+class KTileLoader: public QObject
+{
+  Q_OBJECT
+
+public:
+  static constexpr int main_tile_idx = -1;
+
+  struct Request
+  {
+    KRenderPack* pack          = nullptr;
+    int          tile_idx      = main_tile_idx;
+    double       pixel_size_mm = 0;
+    bool         is_prefetch   = false;
+    bool         operator==(const Request&) const;
+  };
+
+private:
+  int            max_queue_size = 16;
+  QThreadPool    pool;
+  QMutex         mutex;
+  QList<Request> queue;
+  QList<Request> active;
+
+  void processNext();
+  int  getFirstPrefetchIdx() const;
+
+signals:
+  void loaded(QRectF rect_m);
+
+public:
+  KTileLoader();
+  virtual ~KTileLoader();
+  bool request(Request);
+  void setMaxQueueSize(int);
+  void setWorkerCount(int);
+  int  getPendingCount();
+  void clear();
+  void cancelPrefetch();
+};
+
+#endif  // KTILELOADER_H
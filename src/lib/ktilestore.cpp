@@ -0,0 +1,205 @@
+#include "ktilestore.h"
+#include "kprojection.h"
+
+static_assert(sizeof(KTileStore::Offset) == 2 * sizeof(float),
+              "KTileStore::Offset must be a packed x/y float pair");
+
+int KTileStore::addString(const QByteArray& str)
+{
+  auto it = string_idx_map.find(str);
+  if (it != string_idx_map.end())
+    return it.value();
+  int idx = string_starts.count() - 1;
+  string_data.append(str);
+  string_starts.append(string_data.count());
+  string_idx_map.insert(str, idx);
+  return idx;
+}
+
+void KTileStore::append(const KObject& obj)
+{
+  Object o;
+  o.class_idx = obj.class_idx;
+  o.frame     = obj.frame;
+  if (!obj.name.isEmpty())
+    o.name_idx = addString(obj.name.toUtf8());
+
+  o.first_polygon = polygon_starts.count() - 1;
+  o.polygon_count = obj.polygons.count();
+  for (auto& polygon: obj.polygons)
+  {
+    coors.append(polygon);
+    polygon_starts.append(coors.count());
+  }
+
+  o.first_lod = lods.count();
+  o.lod_count = obj.lods.count();
+  for (auto& lod: obj.lods)
+  {
+    lods.append({lod.level, polygon_starts.count() - 1});
+    for (auto& polygon: lod.polygons)
+    {
+      coors.append(polygon);
+      polygon_starts.append(coors.count());
+    }
+  }
+
+  o.first_attribute = attributes.count();
+  o.attribute_count = obj.attributes.count();
+  for (auto it = obj.attributes.begin(); it != obj.attributes.end();
+       it++)
+    attributes.append({addString(it.key().toUtf8()),
+                       addString(it.value())});
+
+  objects.append(o);
+}
+
+void KTileStore::squeeze()
+{
+  coors.squeeze();
+  offsets_m.squeeze();
+  polygon_origins_m.squeeze();
+  polygon_starts.squeeze();
+  objects.squeeze();
+  lods.squeeze();
+  attributes.squeeze();
+  string_data.squeeze();
+  string_starts.squeeze();
+  string_idx_map.clear();
+  string_idx_map.squeeze();
+}
+
+void KTileStore::clear()
+{
+  *this = KTileStore();
+}
+
+qint64 KTileStore::getMemorySize() const
+{
+  return sizeof(*this) + coors.capacity() * sizeof(KGeoCoor) +
+         offsets_m.capacity() * sizeof(Offset) +
+         polygon_origins_m.capacity() * sizeof(QPointF) +
+         polygon_starts.capacity() * sizeof(int) +
+         objects.capacity() * sizeof(Object) +
+         lods.capacity() * sizeof(Lod) +
+         attributes.capacity() * sizeof(Attribute) +
+         string_data.capacity() +
+         string_starts.capacity() * sizeof(int) +
+         rtree.getMemorySize();
+}
+
+void KTileStore::project()
+{
+  QVector<QPointF> polygon_m;
+  offsets_m.resize(coors.count());
+  polygon_origins_m.resize(polygon_starts.count() - 1);
+  for (int i = 0; i < polygon_origins_m.count(); i++)
+  {
+    auto start = polygon_starts[i];
+    auto count = polygon_starts[i + 1] - start;
+    if (count == 0)
+      continue;
+    polygon_m.resize(count);
+    kmath::deg2meters(&coors.constData()[start], count,
+                      polygon_m.data());
+    auto origin_m        = polygon_m.first();
+    polygon_origins_m[i] = origin_m;
+    for (int j = 0; j < count; j++)
+      offsets_m[start + j] = {float(polygon_m[j].x() - origin_m.x()),
+                              float(polygon_m[j].y() - origin_m.y())};
+  }
+  coors = QVector<KGeoCoor>();
+  for (auto& obj: objects)
+    obj.frame_m = obj.frame.toRectM();
+}
+
+void KTileStore::buildIndex()
+{
+  QVector<QRectF> rects;
+  rects.reserve(objects.count());
+  for (auto& obj: objects)
+    rects.append(obj.frame_m);
+  rtree.build(rects);
+}
+
+const KTileStore::Offset* KTileStore::getPolygonM(
+    int polygon_idx, int& count, QPointF& origin_m) const
+{
+  auto start = polygon_starts[polygon_idx];
+  count      = polygon_starts[polygon_idx + 1] - start;
+  origin_m   = polygon_origins_m[polygon_idx];
+  return &offsets_m.constData()[start];
+}
+
+int KTileStore::getFirstPolygon(const Object& obj, double mip) const
+{
+  int first_polygon = obj.first_polygon;
+  for (int i = obj.first_lod; i < obj.first_lod + obj.lod_count; i++)
+  {
+    if (KObject::getLodToleranceM(lods[i].level) > mip)
+      break;
+    first_polygon = lods[i].first_polygon;
+  }
+  return first_polygon;
+}
+
+QPolygonF KTileStore::getPolygonM(int polygon_idx) const
+{
+  int       count = 0;
+  QPointF   origin_m;
+  auto      polygon = getPolygonM(polygon_idx, count, origin_m);
+  QPolygonF ret;
+  ret.reserve(count);
+  for (int i = 0; i < count; i++)
+    ret.append(origin_m + QPointF(polygon[i].x, polygon[i].y));
+  return ret;
+}
+
+QRectF KTileStore::getPolygonRectM(int polygon_idx) const
+{
+  int     count = 0;
+  QPointF origin_m;
+  auto    polygon = getPolygonM(polygon_idx, count, origin_m);
+  if (count == 0)
+    return QRectF();
+  float left   = polygon[0].x;
+  float right  = left;
+  float top    = polygon[0].y;
+  float bottom = top;
+  for (int i = 1; i < count; i++)
+  {
+    left   = std::min(left, polygon[i].x);
+    right  = std::max(right, polygon[i].x);
+    top    = std::min(top, polygon[i].y);
+    bottom = std::max(bottom, polygon[i].y);
+  }
+  return QRectF{QPointF{left, top}, QPointF{right, bottom}}
+      .translated(origin_m);
+}
+
+QByteArray KTileStore::getString(int string_idx) const
+{
+  if (string_idx < 0)
+    return QByteArray();
+  auto start = string_starts[string_idx];
+  return QByteArray::fromRawData(&string_data.constData()[start],
+                                 string_starts[string_idx + 1] -
+                                     start);
+}
+
+QString KTileStore::getName(const Object& obj) const
+{
+  if (obj.name_idx < 0)
+    return QString();
+  return QString::fromUtf8(getString(obj.name_idx));
+}
+
+int KTileStore::findAttribute(const Object& obj, QString key) const
+{
+  auto key_utf8 = key.toUtf8();
+  for (int i = obj.first_attribute;
+       i < obj.first_attribute + obj.attribute_count; i++)
+    if (getString(attributes[i].key_idx) == key_utf8)
+      return attributes[i].value_idx;
+  return -1;
+}
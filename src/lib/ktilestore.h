@@ -0,0 +1,74 @@
+#ifndef KTILESTORE_H
+#define KTILESTORE_H
+
+#include "kobject.h"
+#include "krtree.h"
+#include <QHash>
+
+struct KTileStore
+{
+  struct Object
+  {
+    int      class_idx       = 0;
+    int      name_idx        = -1;
+    int      first_polygon   = 0;
+    int      polygon_count   = 0;
+    int      first_attribute = 0;
+    int      attribute_count = 0;
+    int      first_lod       = 0;
+    int      lod_count       = 0;
+    KGeoRect frame;
+    QRectF   frame_m;
+  };
+
+  struct Lod
+  {
+    int level         = 0;
+    int first_polygon = 0;
+  };
+
+  struct Attribute
+  {
+    int key_idx   = 0;
+    int value_idx = 0;
+  };
+
+  struct Offset
+  {
+    float x = 0;
+    float y = 0;
+  };
+
+  QVector<KGeoCoor>  coors;
+  QVector<Offset>    offsets_m;
+  QVector<QPointF>   polygon_origins_m;
+  QVector<int>       polygon_starts = {0};
+  QVector<Object>    objects;
+  QVector<Lod>       lods;
+  QVector<Attribute> attributes;
+  QByteArray         string_data;
+  QVector<int>       string_starts = {0};
+  KRTree             rtree;
+
+  void           append(const KObject& obj);
+  void           project();
+  void           buildIndex();
+  void           squeeze();
+  void           clear();
+  qint64         getMemorySize() const;
+  const Offset*  getPolygonM(int polygon_idx, int& count,
+                             QPointF& origin_m) const;
+  QPolygonF      getPolygonM(int polygon_idx) const;
+  QRectF         getPolygonRectM(int polygon_idx) const;
+  int            getFirstPolygon(const Object& obj, double mip) const;
+  QByteArray     getString(int string_idx) const;
+  QString        getName(const Object& obj) const;
+  int            findAttribute(const Object& obj, QString key) const;
+
+private:
+  QHash<QByteArray, int> string_idx_map;
+
+  int addString(const QByteArray& str);
+};
+
+#endif  // KTILESTORE_H
@@ -0,0 +1,235 @@
+#include "klinemerger.h"
+
+KLineMerger::Cell KLineMerger::getCell(QPointF p_m) const
+{
+  return {int(floor(p_m.x() / tolerance_m)),
+          int(floor(p_m.y() / tolerance_m))};
+}
+
+bool KLineMerger::findEnd(QPointF p_m, bool is_last, bool can_reverse,
+                          End& end)
+{
+  auto cell = getCell(p_m);
+  for (int pass = 0; pass < 2; pass++)
+  {
+    if (pass == 1)
+    {
+      if (!can_reverse)
+        break;
+      is_last = !is_last;
+    }
+    for (int dy = -1; dy <= 1; dy++)
+      for (int dx = -1; dx <= 1; dx++)
+      {
+        auto it = ends.find({cell.first + dx, cell.second + dy});
+        if (it == ends.end())
+          continue;
+        for (auto e: it.value())
+        {
+          auto& line = lines[e.line_idx];
+          if (line.is_used || e.is_last != is_last)
+            continue;
+          auto end_m = e.is_last ? line.last_m : line.first_m;
+          if (fabs(end_m.x() - p_m.x()) < tolerance_m &&
+              fabs(end_m.y() - p_m.y()) < tolerance_m)
+          {
+            end = e;
+            return true;
+          }
+        }
+      }
+  }
+  return false;
+}
+
+int KLineMerger::findRoot(int owner)
+{
+  while (owner_roots[owner] != owner)
+  {
+    owner_roots[owner] = owner_roots[owner_roots[owner]];
+    owner              = owner_roots[owner];
+  }
+  return owner;
+}
+
+void KLineMerger::unite(int owner1, int owner2)
+{
+  auto root1 = findRoot(owner1);
+  auto root2 = findRoot(owner2);
+  if (root1 < root2)
+    owner_roots[root2] = root1;
+  else
+    owner_roots[root1] = root2;
+}
+
+void KLineMerger::mergeGroup(QVector<KObject>&   obj_list,
+                             const QVector<int>& obj_idx_list,
+                             bool                can_reverse,
+                             QVector<bool>&      is_removed)
+{
+  lines.clear();
+  ends.clear();
+  owner_roots.resize(obj_idx_list.count());
+  for (int owner = -1; auto obj_idx: obj_idx_list)
+  {
+    owner++;
+    owner_roots[owner] = owner;
+    for (auto& polygon: obj_list[obj_idx].polygons)
+    {
+      Line line;
+      line.polygon = polygon;
+      line.owner   = owner;
+      if (!polygon.isEmpty())
+      {
+        line.first_m = polygon.first().toMeters();
+        line.last_m  = polygon.last().toMeters();
+      }
+      lines.append(line);
+    }
+  }
+  for (int i = -1; auto& line: lines)
+  {
+    i++;
+    line_count++;
+    point_count += line.polygon.count();
+    if (line.polygon.count() < 2)
+      continue;
+    ends[getCell(line.first_m)].append({i, false});
+    ends[getCell(line.last_m)].append({i, true});
+  }
+
+  QVector<Chain> chains;
+  for (auto& line: lines)
+  {
+    if (line.is_used)
+      continue;
+    line.is_used = true;
+
+    Chain chain;
+    chain.polygon = line.polygon;
+    chain.owner   = line.owner;
+    if (line.polygon.count() < 2)
+    {
+      chains.append(chain);
+      continue;
+    }
+
+    auto first_m = line.first_m;
+    auto last_m  = line.last_m;
+    End  e;
+    while (findEnd(last_m, false, can_reverse, e))
+    {
+      auto& next    = lines[e.line_idx];
+      next.is_used  = true;
+      auto  polygon = next.polygon;
+      if (e.is_last)
+        std::reverse(polygon.begin(), polygon.end());
+      last_m = e.is_last ? next.first_m : next.last_m;
+      chain.polygon.append(polygon.mid(1));
+      unite(chain.owner, next.owner);
+    }
+
+    QVector<KGeoPolygon> prev_pieces;
+    while (findEnd(first_m, true, can_reverse, e))
+    {
+      auto& prev    = lines[e.line_idx];
+      prev.is_used  = true;
+      auto  polygon = prev.polygon;
+      if (!e.is_last)
+        std::reverse(polygon.begin(), polygon.end());
+      first_m = e.is_last ? prev.first_m : prev.last_m;
+      polygon.removeLast();
+      prev_pieces.append(polygon);
+      unite(chain.owner, prev.owner);
+    }
+    if (!prev_pieces.isEmpty())
+    {
+      KGeoPolygon polygon;
+      for (int i = prev_pieces.count() - 1; i >= 0; i--)
+        polygon.append(prev_pieces[i]);
+      polygon.append(chain.polygon);
+      chain.polygon = polygon;
+    }
+    chains.append(chain);
+  }
+
+  for (int owner = -1; auto obj_idx: obj_idx_list)
+  {
+    owner++;
+    if (findRoot(owner) == owner)
+    {
+      obj_list[obj_idx].polygons.clear();
+      obj_list[obj_idx].frame = KGeoRect();
+    }
+    else
+      is_removed[obj_idx] = true;
+  }
+  for (auto& chain: chains)
+  {
+    auto& obj = obj_list[obj_idx_list[findRoot(chain.owner)]];
+    obj.polygons.append(chain.polygon);
+    if (obj.frame.isNull())
+      obj.frame = chain.polygon.getFrame();
+    else
+      obj.frame = obj.frame.united(chain.polygon.getFrame());
+    chain_count++;
+  }
+}
+
+void KLineMerger::merge(QVector<KObject>&      obj_list,
+                        const QVector<KClass>& classes)
+{
+  QVector<bool> is_removed(obj_list.count());
+
+  QVector<QVector<int>>                    groups;
+  QHash<QPair<int, QString>, QVector<int>> group_map;
+  for (int i = -1; auto& obj: obj_list)
+  {
+    i++;
+    if (classes[obj.class_idx].type != KClass::Line)
+      continue;
+    if (!merge_objects || obj.name.isEmpty())
+    {
+      groups.append(QVector<int>{i});
+      continue;
+    }
+    auto& group_idx_list = group_map[{obj.class_idx, obj.name}];
+    bool  found          = false;
+    for (auto group_idx: group_idx_list)
+    {
+      auto& group = groups[group_idx];
+      if (obj_list[group.first()].attributes == obj.attributes)
+      {
+        group.append(i);
+        found = true;
+        break;
+      }
+    }
+    if (!found)
+    {
+      group_idx_list.append(groups.count());
+      groups.append(QVector<int>{i});
+    }
+  }
+
+  for (auto& group: groups)
+  {
+    bool can_reverse =
+        classes[obj_list[group.first()].class_idx].style !=
+        KClass::Hatch;
+    mergeGroup(obj_list, group, can_reverse, is_removed);
+  }
+
+  QVector<KObject> result;
+  for (int i = -1; auto& obj: obj_list)
+  {
+    i++;
+    if (is_removed[i])
+      continue;
+    if (classes[obj.class_idx].type == KClass::Line)
+      for (auto& polygon: obj.polygons)
+        chain_point_count += polygon.count();
+    result.append(obj);
+  }
+  obj_list = result;
+}
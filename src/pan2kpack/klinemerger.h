@@ -0,0 +1,56 @@
+#ifndef KLINEMERGER_H
+#define KLINEMERGER_H
+
+#include "kobject.h"
+#include <QHash>
+
+struct KLineMerger
+{
+  double tolerance_m       = 1.0;
+  bool   merge_objects     = false;
+  int    line_count        = 0;
+  int    chain_count       = 0;
+  qint64 point_count       = 0;
+  qint64 chain_point_count = 0;
+
+  void merge(QVector<KObject>&      obj_list,
+             const QVector<KClass>& classes);
+
+private:
+  typedef QPair<int, int> Cell;
+
+  struct Line
+  {
+    KGeoPolygon polygon;
+    QPointF     first_m;
+    QPointF     last_m;
+    int         owner   = 0;
+    bool        is_used = false;
+  };
+
+  struct End
+  {
+    int  line_idx = 0;
+    bool is_last  = false;
+  };
+
+  struct Chain
+  {
+    KGeoPolygon polygon;
+    int         owner = 0;
+  };
+
+  QVector<Line>             lines;
+  QHash<Cell, QVector<End>> ends;
+  QVector<int>              owner_roots;
+
+  Cell getCell(QPointF p_m) const;
+  bool findEnd(QPointF p_m, bool is_last, bool can_reverse, End& end);
+  int  findRoot(int owner);
+  void unite(int owner1, int owner2);
+  void mergeGroup(QVector<KObject>& obj_list,
+                  const QVector<int>& obj_idx_list, bool can_reverse,
+                  QVector<bool>& is_removed);
+};
+
+#endif  // KLINEMERGER_H
@@ -4,6 +4,31 @@
 #include <QJsonObject>
 #include <QMetaEnum>
 
+namespace
+{
+bool isEmptyRule(const KPanClass* sh)
+{
+  return sh->pan_code == 0 && sh->pan_key.isEmpty() &&
+         sh->attrname.isEmpty() && sh->attrval.isEmpty();
+}
+
+bool hasAttributeRule(const KPanClass* sh)
+{
+  return !sh->attrname.isEmpty() || !sh->attrval.isEmpty();
+}
+
+bool matchAttributes(const KPanClass*   sh,
+                     const QStringList& attr_names,
+                     const QStringList& attr_values)
+{
+  if (!sh->attrname.isEmpty() && !attr_names.contains(sh->attrname))
+    return false;
+  if (!sh->attrval.isEmpty() && !attr_values.contains(sh->attrval))
+    return false;
+  return true;
+}
+}
+
 KPanClassManager::KPanClassManager(QString image_dir):
     KClassManager(image_dir)
 {
@@ -164,6 +189,7 @@ void KPanClassManager::loadClasses(QString path, QString images_dir)
       }
     }
   }
+  compileRules();
 }
 
 QVector<KPanClass*> KPanClassManager::getClasses()
@@ -171,9 +197,84 @@ QVector<KPanClass*> KPanClassManager::getClasses()
   return pan_classes;
 }
 
-int KPanClassManager::getClassIdx(int code, QString key,
-                                  QStringList attr_names,
-                                  QStringList attr_values)
+void KPanClassManager::compileRules()
+{
+  rules_by_code.clear();
+  any_code_rules = RuleBucket();
+
+  QSet<int> codes;
+  for (auto sh: pan_classes)
+    if (sh->pan_code > 0)
+      codes.insert(sh->pan_code);
+
+  auto fillBucket = [this](RuleBucket& bucket, int code)
+  {
+    QVector<int> rules;
+    for (int idx = -1; auto sh: pan_classes)
+    {
+      idx++;
+      if (isEmptyRule(sh))
+        continue;
+      if (sh->pan_code == 0 || sh->pan_code == code)
+        rules.append(idx);
+    }
+    QSet<QString> keys;
+    for (auto idx: rules)
+      if (!pan_classes[idx]->pan_key.isEmpty())
+        keys.insert(pan_classes[idx]->pan_key);
+    for (auto idx: rules)
+      if (pan_classes[idx]->pan_key.isEmpty())
+        bucket.any_key.append(idx);
+    for (auto key: keys)
+    {
+      auto& key_rules = bucket.by_key[key];
+      for (auto idx: rules)
+      {
+        auto& pan_key = pan_classes[idx]->pan_key;
+        if (pan_key.isEmpty() || pan_key == key)
+          key_rules.append(idx);
+      }
+    }
+  };
+
+  for (auto code: codes)
+    fillBucket(rules_by_code[code], code);
+  fillBucket(any_code_rules, 0);
+}
+
+const QVector<int>& KPanClassManager::getRules(
+    int code, const QString& key) const
+{
+  auto code_it = rules_by_code.find(code);
+  auto& bucket =
+      (code_it == rules_by_code.end()) ? any_code_rules : *code_it;
+  auto key_it = bucket.by_key.find(key);
+  if (key_it == bucket.by_key.end())
+    return bucket.any_key;
+  return *key_it;
+}
+
+bool KPanClassManager::needsAttributes(int            code,
+                                       const QString& key) const
+{
+  auto& rules = getRules(code, key);
+  return !rules.isEmpty() &&
+         hasAttributeRule(pan_classes[rules.first()]);
+}
+
+int KPanClassManager::getClassIdx(
+    int code, const QString& key, const QStringList& attr_names,
+    const QStringList& attr_values) const
+{
+  for (auto idx: getRules(code, key))
+    if (matchAttributes(pan_classes[idx], attr_names, attr_values))
+      return idx;
+  return -1;
+}
+
+int KPanClassManager::getClassIdxLinear(
+    int code, const QString& key, const QStringList& attr_names,
+    const QStringList& attr_values) const
 {
   for (int idx = -1; auto& sh: pan_classes)
   {
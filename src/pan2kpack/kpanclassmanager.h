@@ -6,13 +6,29 @@
 
 class KPanClassManager: public KClassManager
 {
-  QVector<KPanClass*> pan_classes;
+  struct RuleBucket
+  {
+    QHash<QString, QVector<int>> by_key;
+    QVector<int>                 any_key;
+  };
+
+  QVector<KPanClass*>    pan_classes;
+  QHash<int, RuleBucket> rules_by_code;
+  RuleBucket             any_code_rules;
+
+  void                compileRules();
+  const QVector<int>& getRules(int code, const QString& key) const;
 
 public:
   KPanClassManager(QString image_dir = QString());
   void loadClasses(QString path, QString images_dir = QString());
-  int  getClassIdx(int code, QString key, QStringList attr_names,
-                   QStringList attr_values);
+  int  getClassIdx(int code, const QString& key,
+                   const QStringList& attr_names,
+                   const QStringList& attr_values) const;
+  int  getClassIdxLinear(int code, const QString& key,
+                         const QStringList& attr_names,
+                         const QStringList& attr_values) const;
+  bool needsAttributes(int code, const QString& key) const;
   QVector<KPanClass*> getClasses();
 };
 
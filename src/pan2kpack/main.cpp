@@ -4,10 +4,12 @@
 #include "mapapi.h"
 #include "qdmcmp.h"
 #include "kpanclassmanager.h"
-#include "kpack.h"
+#include "klinemerger.h"
+#include "kpackwriter.h"
 #include <QApplication>
 #include <QtConcurrent/QtConcurrent>
 #include <QDir>
+#include <QCommandLineParser>
 #include <QDebug>
 
 bool isVectorMap(QString path)
@@ -20,399 +22,488 @@ bool isVectorMap(QString path)
       .contains(ext);
 }
 
-auto joinPolys(KObject& obj)
+struct ConvertContext
 {
-  double join_tolerance_m = 1.0;
-  auto   polygons         = obj.polygons;
-  for (int i = -1; auto& polygon1: polygons)
-  {
-    i++;
-    auto last1 = polygon1.last();
-    for (int j = -1; auto& polygon2: polygons)
-    {
-      j++;
-      if (i == j)
-        continue;
-      auto first2   = polygon2.first();
-      auto last1_m  = last1.toMeters();
-      auto first2_m = first2.toMeters();
-      auto dx       = fabs(last1_m.x() - first2_m.x());
-      auto dy       = fabs(last1_m.y() - first2_m.y());
-      if (dx < join_tolerance_m && dy < join_tolerance_m)
-      {
-        polygon1.append(polygon2);
-        obj.polygons.removeAt(j);
-        return true;
-      }
-    }
-  }
-  return false;
+  QString             src_dir;
+  QString             output_dir;
+  KCodec::Type        codec                  = KCodec::Zlib;
+  bool                is_analyzing_local_map = false;
+  bool                merge_objects          = false;
+  qint64              memory_budget          = 256 << 20;
+  KClassManager*      class_man              = nullptr;
+  KPanClassManager*   pan_class_man          = nullptr;
+  QVector<KClass>     class_list;
+  QVector<KPanClass*> pan_class_list;
+  const KPack*        world_pack             = nullptr;
+  QMutex*             map_api_mutex          = nullptr;
+};
+
+struct StageStats
+{
+  qint64 merge_ms  = 0;
+  qint64 lod_ms    = 0;
+  qint64 lod_count = 0;
+};
+
+void logStage(QString map_name, QString stage, qint64 count,
+              QString unit, qint64 ms)
+{
+  qDebug() << map_name << stage << "elapsed" << ms << "ms," << count
+           << unit + "," << count * 1000 / std::max<qint64>(1, ms)
+           << unit << "per second";
 }
 
-void setObjects(KPack* pack, QVector<KObject> src_obj_list,
-                int max_objects_per_tile)
+void writeObjects(const ConvertContext& ctx, KLineMerger& line_merger,
+                  QVector<KObject>& obj_list, KPackWriter& writer,
+                  StageStats& stats)
 {
-  int tile_side_num =
-      std::ceil(1.0 * src_obj_list.count() / max_objects_per_tile);
-  int tile_num = pow(tile_side_num, 2);
-  pack->tiles.resize(tile_num);
-  auto map_size_m     = pack->frame.getSizeMeters();
-  auto map_top_left_m = pack->frame.top_left.toMeters();
-  for (auto& src_obj: src_obj_list)
-  {
-    KObject obj(src_obj);
-    auto    cl = pack->classes[obj.class_idx];
-    if (cl.max_mip == 0 || cl.max_mip > pack->tile_mip)
-      pack->main.append(obj);
-    else
-    {
-      auto   obj_top_left_m = obj.frame.top_left.toMeters();
-      double shift_x_m      = obj_top_left_m.x() - map_top_left_m.x();
-      int    part_idx_x =
-          1.0 * shift_x_m / map_size_m.width() * tile_side_num;
-      int shift_y = obj_top_left_m.y() - map_top_left_m.y();
-      int part_idx_y =
-          1.0 * shift_y / map_size_m.height() * tile_side_num;
-      int tile_idx = part_idx_y * tile_side_num + part_idx_x;
-      pack->tiles[tile_idx].append(obj);
-    }
-  }
+  QElapsedTimer t;
+  t.start();
+  line_merger.merge(obj_list, ctx.class_list);
+  stats.merge_ms += t.restart();
+  QtConcurrent::blockingMap(obj_list,
+                            [&ctx](KObject& obj)
+                            {
+                              obj.buildLods(ctx.class_list);
+                            });
+  stats.lod_ms += t.elapsed();
+  stats.lod_count += obj_list.count();
+  for (auto& obj: obj_list)
+    writer.addObject(obj);
+  obj_list.clear();
 }
 
-int main(int argc, char* argv[])
+void convertMap(const ConvertContext& ctx, QString map_name)
 {
   using namespace kmath;
 
-  QApplication a(argc, argv);
-  QDMapView    qd;
-
-  KClassManager class_man(argv[1]);
-  class_man.loadClasses(QString(argv[1]) + "/" + argv[2],
-                        QString(argv[1]) + "/images");
-  auto class_list = class_man.getClasses();
-
-  KPanClassManager pan_class_man(argv[1]);
-  pan_class_man.loadClasses(QString(argv[1]) + "/" + argv[2],
-                            QString(argv[1]) + "/images");
-  auto pan_class_list = pan_class_man.getClasses();
-
-  auto str = pan_class_man.getErrorStr();
-  if (!str.isEmpty())
+  qDebug() << "opening" << map_name;
+  auto src_path = ctx.src_dir + "/" + map_name;
+  // the map api is not documented as thread-safe, so every call into
+  // it is serialized; merge, LOD and compression run in parallel
+  QMutexLocker map_api_locker(ctx.map_api_mutex);
+  HMAP hMap = mapOpenData(src_path.toUtf8(), GENERIC_READ);
+  if (!hMap)
   {
-    qDebug() << "ERROR: class manager error:" << str;
-    return -1;
+    qDebug() << "ERROR: unable to open" << map_name;
+    return;
   }
-
-  if (class_list.isEmpty())
+  DFRAME df;
+  mapGetTotalBorder(hMap, &df, PP_GEO);
+  int  object_count = mapGetObjectCount(hMap, 1);
+  HOBJ info         = mapCreateSiteObject(hMap, hMap);
+  map_api_locker.unlock();
+  qDebug() << "  converting...";
+
+  int  poi_count = 0;
+  auto path      = ctx.output_dir + "/" + map_name + ".kpack";
+  path.remove(".sitx");
+  path.remove(".sitz");
+  path.remove(".mptz");
+  KPack pack;
+
+  if (ctx.is_analyzing_local_map)
   {
-    qDebug() << "ERROR: empty class list!";
-    return -1;
+    qDebug() << "adding borders...";
+    auto map_code = map_name;
+    map_code.remove(".sitx");
+    map_code.remove(".sitz");
+    map_code.remove(".mptz");
+    bool found_borders = false;
+    for (auto obj: ctx.world_pack->main)
+    {
+      auto attr_val =
+          QString::fromUtf8(obj.attributes.value("iso_code"))
+              .toLower();
+      if (!attr_val.isEmpty() && map_code.contains(attr_val))
+      {
+        found_borders = true;
+        for (auto polygon: obj.polygons)
+          pack.borders.append(polygon);
+      }
+    }
+    if (!found_borders)
+      qDebug() << "ERROR: no borders found for" << map_name;
   }
 
-  QDir dir(argv[3]);
-  dir.setFilter(QDir::Files | QDir::NoSymLinks |
-                QDir::NoDotAndDotDot);
-  auto        list = dir.entryInfoList();
-  QStringList map_name_list;
-  for (auto& fi: list)
-    map_name_list.append(fi.fileName());
-  std::sort(map_name_list.begin(), map_name_list.end());
+  pack.codec    = ctx.codec;
+  pack.classes  = ctx.class_list;
+  pack.main_mip = ctx.class_man->getMainMip();
+  pack.tile_mip = ctx.class_man->getTileMip();
+  QVector<KObject> obj_list;
 
-  mapMessageEnable(1);
-  QString output_dir = argv[4];
-  QDir().mkdir(argv[4]);
+  auto top_left = KGeoCoor::fromDegs(rad2deg(df.X2), rad2deg(df.Y1));
+  auto bottom_right =
+      KGeoCoor::fromDegs(rad2deg(df.X1), rad2deg(df.Y2));
+  pack.frame = {top_left, bottom_right};
 
-  bool is_analyzing_local_map = false;
-  if (QString(argv[2]).contains("local"))
-    is_analyzing_local_map = true;
+  KPackWriter writer;
+  writer.setMemoryBudget(ctx.memory_budget);
+  if (!writer.open(path, pack))
+  {
+    map_api_locker.relock();
+    mapCloseData(hMap);
+    return;
+  }
 
-  auto  world_map_path = output_dir + "/world.kpack";
-  KPack world_pack;
+  KLineMerger line_merger;
+  line_merger.merge_objects = ctx.merge_objects;
+  const int  batch_size     = 10000;
+  StageStats stats;
 
-  if (is_analyzing_local_map)
+  qDebug() << map_name << "total object count" << object_count;
+
+  int           curr_percentage = 0;
+  QElapsedTimer t;
+  t.start();
+
+  for (int in_obj_idx = 0; in_obj_idx < object_count; in_obj_idx++)
   {
-    if (QFile(world_map_path).exists())
-      world_pack.loadAll(world_map_path, 0);
-    else
+    QString name;
+
+    int percentage = 100 * in_obj_idx / object_count;
+    if (percentage / 10 != curr_percentage / 10)
+      qDebug() << map_name << percentage << "% read";
+    curr_percentage = percentage;
+
+    QMutexLocker read_locker(ctx.map_api_mutex);
+    mapClearObject(info);
+    mapReadObjectByNumber(hMap, hMap, info, 1, in_obj_idx + 1);
+
+    int code = mapObjectExcode(info);
+
+    WCHAR key_wchar[100];
+    mapObjectRscKeyUn(info, key_wchar, sizeof(key_wchar));
+    auto key = QString::fromUtf16(key_wchar);
+
+    QStringList attr_names;
+    QStringList attr_values;
+    int         semantic_count = 0;
+    if (ctx.pan_class_man->needsAttributes(code, key))
+      semantic_count = mapSemanticAmount(info);
+    for (int sematic_idx = 1; sematic_idx <= semantic_count;
+         sematic_idx++)
     {
-      qDebug() << "ERROR: world map not found!";
-      return -1;
+      WCHAR str_utf16[1000];
+      if (mapSemanticNameUn(info, sematic_idx, str_utf16,
+                            sizeof(str_utf16)))
+      {
+        attr_names.append(QString::fromUtf16(str_utf16).simplified());
+      }
+      if (mapSemanticValueUnicode(info, sematic_idx, str_utf16,
+                                  sizeof(str_utf16)))
+        attr_values.append(
+            QString::fromUtf16(str_utf16).simplified());
     }
-  }
 
-  for (auto& map_name: map_name_list)
-  {
-    if (!isVectorMap(map_name))
-      continue;
-
-    qDebug() << "opening" << map_name;
-    HMAP hMap = mapOpenData(
-        (QString(argv[3]) + "/" + map_name).toUtf8(), GENERIC_READ);
-    if (!hMap)
+    int class_idx = ctx.pan_class_man->getClassIdx(
+        code, key, attr_names, attr_values);
+    if (class_idx < 0)
     {
-      qDebug() << "    error";
-      continue;
+      WCHAR   str_utf16[1000];
+      QString name;
+
+      if (mapSemanticCodeValueNameUn(info, 9, str_utf16,
+                                     sizeof(str_utf16), 1))
+        name = QString::fromUtf16(str_utf16).simplified();
+      int point_count = mapPointCount(info, 0);
+      if (!name.isEmpty() && point_count == 1)
+      {
+        class_idx =
+            ctx.class_man->getClassIdxById("default_named_point");
+        if (class_idx < 0)
+          continue;
+        poi_count++;
+      }
+      else
+        continue;
     }
-    qDebug() << "  converting...";
 
-    int  poi_count = 0;
-    auto path      = output_dir + "/" + map_name + ".kpack";
-    path.remove(".sitx");
-    path.remove(".sitz");
-    path.remove(".mptz");
-    KPack pack;
+    auto pan_class = ctx.pan_class_list.at(class_idx);
 
-    if (is_analyzing_local_map)
+    if (pan_class->type == KClass::None)
+      continue;
+
+    WCHAR str_utf16[1000];
+    if (mapSemanticCodeValueNameUn(info, 9, str_utf16,
+                                   sizeof(str_utf16), 1))
+      name = QString::fromUtf16(str_utf16).simplified();
+
+    if (pan_class->name_code > 0)
     {
-      qDebug() << "adding borders...";
-      auto map_code = map_name;
-      map_code.remove(".sitx");
-      map_code.remove(".sitz");
-      map_code.remove(".mptz");
-      bool found_borders = false;
-      for (auto obj: world_pack.main)
+      name.clear();
+      if (mapSemanticCodeValueNameUn(info, pan_class->name_code,
+                                     str_utf16, sizeof(str_utf16), 1))
       {
-        auto attr_val =
-            QString::fromUtf8(obj.attributes.value("iso_code"))
-                .toLower();
-        if (!attr_val.isEmpty() && map_code.contains(attr_val))
-        {
-          found_borders = true;
-          for (auto polygon: obj.polygons)
-            pack.borders.append(polygon);
-        }
+        auto n = QString::fromUtf16(str_utf16).simplified();
+        if (n != name)
+          name += "\n" + QString::fromUtf16(str_utf16).simplified();
       }
-      if (!found_borders)
-        qDebug() << "ERROR: no borders found for" << map_name;
     }
 
-    pack.classes  = class_list;
-    pack.main_mip = class_man.getMainMip();
-    pack.tile_mip = class_man.getTileMip();
-    QVector<KObject> obj_list;
-    DFRAME           df;
-    mapGetTotalBorder(hMap, &df, PP_GEO);
-    auto top_left =
-        KGeoCoor::fromDegs(rad2deg(df.X2), rad2deg(df.Y1));
-    auto bottom_right =
-        KGeoCoor::fromDegs(rad2deg(df.X1), rad2deg(df.Y2));
-    pack.frame = {top_left, bottom_right};
+    name = name.remove("\"");
 
-    int  object_count = mapGetObjectCount(hMap, 1);
-    HOBJ info         = mapCreateSiteObject(hMap, hMap);
+    KObject obj;
+    obj.name = name;
 
-    qDebug() << "total object count" << object_count;
+    obj.class_idx = class_idx;
+    KClass cl     = ctx.class_list[class_idx];
 
-    int curr_percentage = 0;
-
-    for (int in_obj_idx = 0; in_obj_idx < object_count; in_obj_idx++)
+    for (auto attr: pan_class->attributes)
     {
-      QString name;
+      WCHAR   str_utf16[1000];
+      QString value;
 
-      int percentage = 100 * in_obj_idx / object_count;
-      if (percentage != curr_percentage)
+      if (mapSemanticCodeValueNameUn(info, attr.code, str_utf16,
+                                     sizeof(str_utf16), 1))
       {
-        fprintf(stderr, "%d%% done\r", percentage);
-        curr_percentage = percentage;
+        value = QString::fromUtf16(str_utf16).simplified();
+        obj.attributes.insert(attr.name, value.toUtf8());
       }
-      mapClearObject(info);
-      mapReadObjectByNumber(hMap, hMap, info, 1, in_obj_idx + 1);
-
-      int code = mapObjectExcode(info);
-
-      WCHAR key_wchar[100];
-      mapObjectRscKeyUn(info, key_wchar, sizeof(key_wchar));
-      auto key = QString::fromUtf16(key_wchar);
+    }
 
-      QStringList attr_names;
-      QStringList attr_values;
-      auto        semantic_count = mapSemanticAmount(info);
-      for (int sematic_idx = 1; sematic_idx <= semantic_count;
-           sematic_idx++)
+    int    poly_count = mapPolyCount(info);
+    double max_dist   = 0;
+    for (int poly_idx = 0; poly_idx < poly_count; poly_idx++)
+    {
+      DOUBLEPOINT point;
+      int         point_count = mapPointCount(info, poly_idx);
+      KGeoPolygon polygon;
+      DOUBLEPOINT prev_point_m;
+      for (int point_idx = 0; point_idx < point_count; point_idx++)
       {
-        WCHAR str_utf16[1000];
-        if (mapSemanticNameUn(info, sematic_idx, str_utf16,
-                              sizeof(str_utf16)))
+        DOUBLEPOINT point_m;
+        if (mapGetPlanePoint(info, &point_m, point_idx + 1, poly_idx))
         {
-          attr_names.append(
-              QString::fromUtf16(str_utf16).simplified());
-        }
-        if (mapSemanticValueUnicode(info, sematic_idx, str_utf16,
-                                    sizeof(str_utf16)))
-          attr_values.append(
-              QString::fromUtf16(str_utf16).simplified());
-      }
+          if (point_idx == 0)
+            prev_point_m = point_m;
+          else
+          {
+            auto dist = sqrt(pow(prev_point_m.x - point_m.x, 2) +
+                             pow(prev_point_m.y - point_m.y, 2));
+            max_dist  = std::max(dist, max_dist);
 
-      int class_idx = pan_class_man.getClassIdx(code, key, attr_names,
-                                                attr_values);
-      if (class_idx < 0)
-      {
-        WCHAR   str_utf16[1000];
-        QString name;
-
-        if (mapSemanticCodeValueNameUn(info, 9, str_utf16,
-                                       sizeof(str_utf16), 1))
-          name = QString::fromUtf16(str_utf16).simplified();
-        int point_count = mapPointCount(info, 0);
-        if (!name.isEmpty() && point_count == 1)
+            if (dist < pan_class->coor_precision_coef * 0.01 &&
+                point_idx < point_count - 1)
+              continue;
+          }
+        }
+        if (mapGetGeoPoint(info, &point, point_idx + 1, poly_idx))
         {
-          class_idx =
-              class_man.getClassIdxById("default_named_point");
-          if (class_idx < 0)
-            continue;
-          poi_count++;
+          auto vp =
+              KGeoCoor::fromDegs(rad2deg(point.x), rad2deg(point.y));
+          polygon.append(vp);
+          prev_point_m = point_m;
         }
-        else
-          continue;
       }
 
-      auto pan_class = pan_class_list.at(class_idx);
-
-      if (pan_class->type == KClass::None)
-        continue;
-
-      WCHAR str_utf16[1000];
-      if (mapSemanticCodeValueNameUn(info, 9, str_utf16,
-                                     sizeof(str_utf16), 1))
-        name = QString::fromUtf16(str_utf16).simplified();
+      bool need_to_wrap = false;
+      if (map_name.contains("ru-chu"))
+        need_to_wrap = true;
+      if (!obj.attributes.isEmpty())
+      {
+        auto attr = obj.attributes.first().toLower();
+        if (attr == "ru-chu")
+          need_to_wrap = true;
+        if (attr.toLower() == "rus")
+          need_to_wrap = true;
+      }
 
-      if (pan_class->name_code > 0)
+      if (need_to_wrap)
       {
-        name.clear();
-        if (mapSemanticCodeValueNameUn(info, pan_class->name_code,
-                                       str_utf16, sizeof(str_utf16),
-                                       1))
-        {
-          auto n = QString::fromUtf16(str_utf16).simplified();
-          if (n != name)
-            name += "\n" + QString::fromUtf16(str_utf16).simplified();
-        }
+        auto polygon_frame = polygon.getFrame();
+        if (polygon_frame.bottom_right.needToWrap())
+          for (auto& p: polygon)
+            p = p.wrapped();
       }
 
-      name = name.remove("\"");
+      obj.polygons.append(polygon);
 
-      KObject obj;
-      obj.name = name;
+      if (obj.frame.isNull())
+        obj.frame = polygon.getFrame();
+      else
+        obj.frame = obj.frame.united(polygon.getFrame());
+    }
+    read_locker.unlock();
 
-      obj.class_idx = class_idx;
-      KClass cl     = class_list[class_idx];
+    if (max_dist < pan_class->coor_precision_coef * 0.01 &&
+        pan_class->type == KClass::Polygon)
+      continue;
 
-      for (auto attr: pan_class->attributes)
+    if (ctx.is_analyzing_local_map)
+      if (cl.id == "океан, море" || cl.id == "водоём" ||
+          cl.id == "река (площадной)")
       {
-        WCHAR   str_utf16[1000];
-        QString value;
-
-        if (mapSemanticCodeValueNameUn(info, attr.code, str_utf16,
-                                       sizeof(str_utf16), 1))
+        if (obj.polygons.count() > 20)
         {
-          value = QString::fromUtf16(str_utf16).simplified();
-          obj.attributes.insert(attr.name, value.toUtf8());
+          auto idx = ctx.class_man->getClassIdxById("complex_water");
+          cl       = ctx.class_list[idx];
         }
       }
 
-      int    poly_count = mapPolyCount(info);
-      double max_dist   = 0;
-      for (int poly_idx = 0; poly_idx < poly_count; poly_idx++)
-      {
-        DOUBLEPOINT point;
-        int         point_count = mapPointCount(info, poly_idx);
-        KGeoPolygon polygon;
-        DOUBLEPOINT prev_point_m;
-        for (int point_idx = 0; point_idx < point_count; point_idx++)
-        {
-          DOUBLEPOINT point_m;
-          if (mapGetPlanePoint(info, &point_m, point_idx + 1,
-                               poly_idx))
-          {
-            if (point_idx == 0)
-              prev_point_m = point_m;
-            else
-            {
-              auto dist = sqrt(pow(prev_point_m.x - point_m.x, 2) +
-                               pow(prev_point_m.y - point_m.y, 2));
-              max_dist  = std::max(dist, max_dist);
-
-              if (dist < pan_class->coor_precision_coef * 0.01 &&
-                  point_idx < point_count - 1)
-                continue;
-            }
-          }
-          if (mapGetGeoPoint(info, &point, point_idx + 1, poly_idx))
-          {
-            auto vp = KGeoCoor::fromDegs(rad2deg(point.x),
-                                         rad2deg(point.y));
-            polygon.append(vp);
-            prev_point_m = point_m;
-          }
-        }
-
-        bool need_to_wrap = false;
-        if (map_name.contains("ru-chu"))
-          need_to_wrap = true;
-        if (!obj.attributes.isEmpty())
-        {
-          auto attr = obj.attributes.first().toLower();
-          if (attr == "ru-chu")
-            need_to_wrap = true;
-          if (attr.toLower() == "rus")
-            need_to_wrap = true;
-        }
+    obj_list.append(obj);
+    if (!ctx.merge_objects && obj_list.count() >= batch_size)
+      writeObjects(ctx, line_merger, obj_list, writer, stats);
+  }
 
-        if (need_to_wrap)
-        {
-          auto polygon_frame = polygon.getFrame();
-          if (polygon_frame.bottom_right.needToWrap())
-            for (auto& p: polygon)
-              p = p.wrapped();
-        }
+  map_api_locker.relock();
+  mapCloseData(hMap);
+  map_api_locker.unlock();
+  writeObjects(ctx, line_merger, obj_list, writer, stats);
+  logStage(map_name, "convert", object_count, "objects", t.restart());
+  logStage(map_name, "merge", line_merger.line_count, "lines",
+           stats.merge_ms);
+  logStage(map_name, "lod", stats.lod_count, "objects", stats.lod_ms);
+  qDebug() << map_name << "poi_count" << poi_count;
+  qDebug() << map_name << "merged" << line_merger.line_count
+           << "lines into" << line_merger.chain_count << "chains,"
+           << line_merger.point_count << "points into"
+           << line_merger.chain_point_count;
+
+  if (!writer.finish())
+  {
+    qDebug() << "ERROR: unable to write" << path;
+    return;
+  }
+  logStage(map_name, "save", QFileInfo(path).size() >> 10, "KB",
+           t.restart());
+  logStage(map_name, "compress", writer.getCompressSize() >> 10, "KB",
+           writer.getCompressMs());
+  qDebug() << map_name << "tile count" << writer.getTileCount()
+           << "spill count" << writer.getSpillCount();
+}
 
-        obj.polygons.append(polygon);
+int main(int argc, char* argv[])
+{
+  QApplication a(argc, argv);
+  QDMapView    qd;
 
-        if (obj.frame.isNull())
-          obj.frame = polygon.getFrame();
-        else
-          obj.frame = obj.frame.united(polygon.getFrame());
-      }
+  QCommandLineParser parser;
+  parser.addHelpOption();
+  parser.addPositionalArgument("class_dir", "classifier directory");
+  parser.addPositionalArgument("class_file", "classifier json");
+  parser.addPositionalArgument("src_dir", "source maps directory");
+  parser.addPositionalArgument("output_dir", "output directory");
+  QCommandLineOption codec_option({"c", "codec"},
+                                  "block codec: zlib or lz4", "codec",
+                                  "zlib");
+  parser.addOption(codec_option);
+  QCommandLineOption merge_objects_option(
+      {"m", "merge-objects"},
+      "merge connected lines of same class and name objects");
+  parser.addOption(merge_objects_option);
+  QCommandLineOption jobs_option(
+      {"j", "jobs"}, "number of maps converted in parallel", "jobs",
+      QString::number(QThread::idealThreadCount()));
+  parser.addOption(jobs_option);
+  QCommandLineOption memory_budget_option(
+      {"b", "memory-budget"},
+      "writer memory budget in MB, shared by parallel jobs",
+      "megabytes", "256");
+  parser.addOption(memory_budget_option);
+  parser.process(a);
+
+  auto args = parser.positionalArguments();
+  if (args.count() < 4)
+    parser.showHelp(-1);
+
+  KCodec::Type codec;
+  if (!KCodec::fromString(parser.value(codec_option), codec))
+  {
+    qDebug() << "ERROR: unknown codec" << parser.value(codec_option);
+    return -1;
+  }
 
-      if (max_dist < pan_class->coor_precision_coef * 0.01 &&
-          pan_class->type == KClass::Polygon)
-        continue;
+  KClassManager class_man(args[0]);
+  class_man.loadClasses(args[0] + "/" + args[1],
+                        args[0] + "/images");
+  auto class_list = class_man.getClasses();
 
-      if (is_analyzing_local_map)
-        if (cl.id == "океан, море" || cl.id == "водоём" ||
-            cl.id == "река (площадной)")
-        {
-          if (obj.polygons.count() > 20)
-          {
-            auto idx = class_man.getClassIdxById("complex_water");
-            cl       = class_list[idx];
-          }
-        }
+  KPanClassManager pan_class_man(args[0]);
+  pan_class_man.loadClasses(args[0] + "/" + args[1],
+                            args[0] + "/images");
+  auto pan_class_list = pan_class_man.getClasses();
 
-      obj_list.append(obj);
-    }
+  auto str = pan_class_man.getErrorStr();
+  if (!str.isEmpty())
+  {
+    qDebug() << "ERROR: class manager error:" << str;
+    return -1;
+  }
 
-    qDebug() << "poi_count" << poi_count;
+  if (class_list.isEmpty())
+  {
+    qDebug() << "ERROR: empty class list!";
+    return -1;
+  }
 
-    qDebug() << "joinPolys() started";
-    QElapsedTimer t;
-    t.start();
-    for (auto obj: obj_list)
-    {
-      KClass cl = class_list[obj.class_idx];
-      if (cl.type == KClass::Line)
-        while (joinPolys(obj))
-          ;
-    }
-    qDebug() << "joinPolys() elapsed" << t.restart();
+  QDir dir(args[2]);
+  dir.setFilter(QDir::Files | QDir::NoSymLinks |
+                QDir::NoDotAndDotDot);
+  auto        list = dir.entryInfoList();
+  QStringList map_name_list;
+  for (auto& fi: list)
+    if (isVectorMap(fi.fileName()))
+      map_name_list.append(fi.fileName());
+  std::sort(map_name_list.begin(), map_name_list.end());
 
-    setObjects(&pack, obj_list, 200000);
+  mapMessageEnable(1);
+  QString output_dir = args[3];
+  QDir().mkdir(args[3]);
 
-    qDebug() << "  saving...";
-    pack.save(path);
+  bool is_analyzing_local_map = false;
+  if (args[1].contains("local"))
+    is_analyzing_local_map = true;
 
-    mapCloseData(hMap);
+  auto  world_map_path = output_dir + "/world.kpack";
+  KPack world_pack;
 
-    qDebug() << "done";
+  if (is_analyzing_local_map)
+  {
+    if (QFile(world_map_path).exists())
+      world_pack.loadAll(world_map_path, 0);
+    else
+    {
+      qDebug() << "ERROR: world map not found!";
+      return -1;
+    }
   }
+
+  int    job_count = std::max(1, parser.value(jobs_option).toInt());
+  qint64 memory_budget =
+      qint64(std::max(1, parser.value(memory_budget_option).toInt()))
+      << 20;
+  QMutex map_api_mutex;
+
+  ConvertContext ctx;
+  ctx.src_dir                = args[2];
+  ctx.output_dir             = output_dir;
+  ctx.codec                  = codec;
+  ctx.is_analyzing_local_map = is_analyzing_local_map;
+  ctx.merge_objects          = parser.isSet(merge_objects_option);
+  ctx.memory_budget          = std::max<qint64>(1 << 20,
+                                       memory_budget / job_count);
+  ctx.class_man              = &class_man;
+  ctx.pan_class_man          = &pan_class_man;
+  ctx.class_list             = class_list;
+  ctx.pan_class_list         = pan_class_list;
+  ctx.world_pack             = &world_pack;
+  ctx.map_api_mutex          = &map_api_mutex;
+
+  QThreadPool map_pool;
+  map_pool.setMaxThreadCount(job_count);
+  QAtomicInt    done_count;
+  QElapsedTimer total_time;
+  total_time.start();
+  for (auto& map_name: map_name_list)
+    map_pool.start(
+        [&, map_name]()
+        {
+          convertMap(ctx, map_name);
+          int count = done_count.fetchAndAddOrdered(1) + 1;
+          qDebug() << "done" << map_name << count << "of"
+                   << map_name_list.count() << "maps";
+        });
+  map_pool.waitForDone();
+  qDebug() << "total elapsed" << total_time.elapsed() << "ms";
 }
@@ -1,30 +1,37 @@
-QT       += widgets
+QT       += widgets concurrent
 QMAKE_CXXFLAGS += -std=c++2a
 QMAKE_CXXFLAGS += -Wno-deprecated-enum-enum-conversion
 
 
 INCLUDEPATH += /home/user/gisdesigner/14/include
 INCLUDEPATH += ../lib
-LIBS += -lmapcomponents -lqdmapacces
+LIBS += -lmapcomponents -lqdmapacces -lz -llz4
+DEFINES += BUILD_WITH_LZ4
 SOURCES += \
     ../lib/kbase.cpp \
     ../lib/klocker.cpp \
     ../lib/kpack.cpp \
+    ../lib/kpackwriter.cpp \
     ../lib/kclass.cpp \
+    ../lib/kcodec.cpp \
     ../lib/kobject.cpp \
     ../lib/kclassmanager.cpp \
     kpanclassmanager.cpp \
+    klinemerger.cpp \
     main.cpp
 
 HEADERS += \
  ../lib/kbase.h \
     ../lib/klocker.h \
     ../lib/kpack.h \
+    ../lib/kpackwriter.h \
     ../lib/kserialize.h \
     ../lib/kclass.h \
+    ../lib/kcodec.h \
     ../lib/kclassmanager.h \
  kpanclass.h \
- kpanclassmanager.h
+ kpanclassmanager.h \
+ klinemerger.h
 
 
 